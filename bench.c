@@ -0,0 +1,231 @@
+/*
+ * FLEP - Fast Lite Expression Parser
+ * Copyright (C) 2019 Gustavo Hime
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Benchmark suite, run by "make bench": for each expression of a file
+ * (expressions.txt by default), the time to parse it, the latency of
+ * "flep_eval" (median and 99th percentile) and the throughput of
+ * "flep_eval_batch", over random values of all seven variables. Results
+ * go to standard output as JSON, or CSV with "-csv", to be compared
+ * between releases.
+ *
+ *   flep_bench [-csv] [file]
+ */
+#define _POSIX_C_SOURCE 199309L /* clock_gettime */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "flep.h"
+
+#define BUFLEN 512
+#define N_INPUT 1024 /* random input vectors, cycled through */
+#define N_ROUND 15 /* rounds of parsing and batches, of which the median */
+#define MIN_ROUND 1e6 /* ns, rounds are repeated until this long */
+#define N_SAMPLE 2000 /* latency samples */
+#define BLOCK 16 /* evaluations per latency sample, the timer being coarse */
+#define N_ROWS 4096 /* rows per batch */
+
+struct Result {
+  double parse; /* ns per "flep_parse" and "flep_free" */
+  double median, p99; /* ns per "flep_eval" */
+  double batch; /* ns per row of "flep_eval_batch" */
+};
+
+volatile double sink; /* keeps results from being optimized away */
+
+double now(void) {
+  struct timespec t;
+  if (clock_gettime(CLOCK_MONOTONIC, &t)) {
+    fprintf(stderr, "clock_gettime failed, aborting.\n");
+    exit(1);
+  }
+  return 1e9 * (double)t.tv_sec + (double)t.tv_nsec;
+}
+
+/* uniform in [0.1, 2.1), away from the poles of log and division */
+double uniform(void) {
+  static unsigned long x = 2463534242UL; /* xorshift, fixed seed */
+  x ^= (x << 13) & 0xffffffffUL;
+  x ^= x >> 17;
+  x ^= (x << 5) & 0xffffffffUL;
+  return 0.1 + 2.0 * (double)(x & 0xffffffUL) / 16777216.0;
+}
+
+int compare_double(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+double median(double* v, int n) {
+  qsort(v, n, sizeof(double), compare_double);
+  return v[n / 2];
+}
+
+/* Non-empty lines of "name" not starting with '#', NULL if unreadable */
+char** read_exprs(const char* name, int* n) {
+  FILE* file = fopen(name, "rb");
+  char buf[BUFLEN], **exprs = 0;
+  *n = 0;
+  if (!file) return 0;
+  while (fgets(buf, BUFLEN, file)) {
+    char* s = buf;
+    size_t len;
+    while (*s == ' ' || *s == '\t') s++;
+    len = strcspn(s, "\r\n");
+    s[len] = 0;
+    if (!len || *s == '#') continue;
+    exprs = (char**)realloc(exprs, (*n + 1) * sizeof(char*));
+    exprs[(*n)++] = strcpy((char*)malloc(len + 1), s);
+  }
+  fclose(file);
+  return exprs;
+}
+
+double time_parse(const char* s) {
+  double t[N_ROUND];
+  int k, i, reps = 1;
+  for (k = 0; k < N_ROUND; k++) {
+    double t1 = now(), t2;
+    for (;;) {
+      for (i = 0; i < reps; i++) flep_free(flep_parse(s, 0, 0));
+      t2 = now();
+      if (t2 - t1 >= MIN_ROUND) break;
+      reps *= 2; /* until a round is long enough, then keep the count */
+      t1 = now();
+    }
+    t[k] = (t2 - t1) / reps;
+  }
+  return median(t, N_ROUND);
+}
+
+/* latency over blocks of BLOCK evaluations, each on the next input */
+void time_eval(const struct FLEP* f, double in[][7], struct Result* r) {
+  static double t[N_SAMPLE];
+  double sum = 0;
+  int k, i, j = 0;
+  for (i = 0; i < N_INPUT; i++) sum += flep_eval(f, in[i]); /* warm up */
+  for (k = 0; k < N_SAMPLE; k++) {
+    double t1 = now();
+    for (i = 0; i < BLOCK; i++) {
+      sum += flep_eval(f, in[j]);
+      j = (j + 1) % N_INPUT;
+    }
+    t[k] = (now() - t1) / BLOCK;
+  }
+  sink += sum;
+  qsort(t, N_SAMPLE, sizeof(double), compare_double);
+  r->median = t[N_SAMPLE / 2];
+  r->p99 = t[N_SAMPLE * 99 / 100];
+}
+
+double time_batch(const struct FLEP* f, const double* const cols[7]) {
+  double t[N_ROUND], *out = (double*)malloc(
+    (flep_outputs(f) ? flep_outputs(f) : 1) * N_ROWS * sizeof(double));
+  int k, i, reps = 1;
+  flep_eval_batch(f, cols, N_ROWS, out); /* warm up */
+  for (k = 0; k < N_ROUND; k++) {
+    double t1 = now(), t2;
+    for (;;) {
+      for (i = 0; i < reps; i++) flep_eval_batch(f, cols, N_ROWS, out);
+      t2 = now();
+      if (t2 - t1 >= MIN_ROUND) break;
+      reps *= 2;
+      t1 = now();
+    }
+    t[k] = (t2 - t1) / reps / N_ROWS;
+    sink += out[N_ROWS - 1];
+  }
+  free(out);
+  return median(t, N_ROUND);
+}
+
+/* "s" as a JSON string, or a CSV field if "csv" */
+void print_string(const char* s, int csv) {
+  putchar('"');
+  for (; *s; s++) {
+    if (*s == '"') fputs(csv ? "\"\"" : "\\\"", stdout);
+    else if (*s == '\\' && !csv) fputs("\\\\", stdout);
+    else if ((unsigned char)*s < 0x20) printf(csv ? " " : "\\u%04x", *s);
+    else putchar(*s);
+  }
+  putchar('"');
+}
+
+int main(int argc, const char* argv[]) {
+  static double in[N_INPUT][7], col[7][N_ROWS];
+  const double* cols[7];
+  const char* name = "expressions.txt";
+  char** exprs;
+  int csv = 0, n, i, j, first = 1;
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-csv")) csv = 1;
+    else name = argv[i];
+  }
+  exprs = read_exprs(name, &n);
+  if (!exprs) {
+    fprintf(stderr, "Failed to open input file \"%s\"\n", name);
+    return 1;
+  }
+  for (i = 0; i < N_INPUT; i++) {
+    for (j = 0; j < 7; j++) in[i][j] = uniform();
+  }
+  for (j = 0; j < 7; j++) {
+    for (i = 0; i < N_ROWS; i++) col[j][i] = uniform();
+    cols[j] = col[j];
+  }
+  if (csv) {
+    printf("expression,parse_ns,eval_median_ns,eval_p99_ns,"
+      "batch_ns_per_row\n");
+  } else {
+    printf("{\n  \"input\": ");
+    print_string(name, 0);
+    printf(",\n  \"timer\": \"clock_gettime(CLOCK_MONOTONIC)\",\n"
+      "  \"expressions\": [");
+  }
+  for (i = 0; i < n; i++) {
+    int error, position;
+    const struct FLEP* f = flep_parse(exprs[i], &error, &position);
+    struct Result r;
+    if (!f) {
+      fprintf(stderr, "FLEP failed to parse (%s), skipped\n%s\n%*s\n",
+	flep_translate(error), exprs[i], position, "^");
+      continue;
+    }
+    r.parse = time_parse(exprs[i]);
+    time_eval(f, in, &r);
+    r.batch = time_batch(f, cols);
+    flep_free(f);
+    if (csv) {
+      print_string(exprs[i], 1);
+      printf(",%.2f,%.2f,%.2f,%.3f\n", r.parse, r.median, r.p99, r.batch);
+    } else {
+      printf("%s\n    {\"expression\": ", first ? "" : ",");
+      print_string(exprs[i], 0);
+      printf(", \"parse_ns\": %.2f, \"eval_median_ns\": %.2f, "
+	"\"eval_p99_ns\": %.2f, \"batch_ns_per_row\": %.3f}",
+	r.parse, r.median, r.p99, r.batch);
+    }
+    first = 0;
+    fflush(stdout);
+  }
+  if (!csv) printf("\n  ]\n}\n");
+  for (i = 0; i < n; i++) free(exprs[i]);
+  free(exprs);
+  return 0;
+}
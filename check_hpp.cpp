@@ -0,0 +1,112 @@
+/*
+ * FLEP - Fast Lite Expression Parser
+ * Copyright (C) 2019 Gustavo Hime
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Check of flep.hpp, built and run by "make check_hpp" in C++17 and C++20:
+ * the built-in expressions of example.c, parsed at compile time by
+ * FLEP_LITERAL (and "..."_flep in C++20) and at run time by
+ * "flep::Expression", must give the results of "flep_eval" bit for bit.
+ * Built with FLEP_BAD_LITERAL defined, it must fail to compile.
+ */
+#include <cstdio>
+#include <cstring>
+#include "flep.hpp"
+
+#define FLEP_BUILT_IN(X) \
+  X("sin(2.2 * a) + cos(pi / b)") \
+  X("1 - sin(2.2 * a) + cos(pi / b)") \
+  X("sqrt(3 + sin(2.2 * a) + cos(pi / b) / 3.3)") \
+  X("(a^2 / sin(2 * pi / b)) -a / 2.2") \
+  X("1-(a/b*0.5)") \
+  X("e^log(7*a)") \
+  X("10^log(3+b)") \
+  X("(cos(2.41)/b)") \
+  X("-(sin(pi+a)+1)") \
+  X("a-(e^(log(7+b)))") \
+  X("(1.123*sin(a)+2.1234)/3.1237") \
+  X("(1.123*cos(a)-3.1235)/3.1238") \
+  X("(1.123*tan(a)+2.1236)/3.1239") \
+  X("(b+a/b) * (a-b/a)") \
+  X("a/((a+b)*(a-b))/b") \
+  X("1.1-((a*b)+(a/b))-3.3") \
+  X("a+b") \
+  X("(a+b)*3.3") \
+  X("(2*a+2*a)") \
+  X("2*(2*a)") \
+  X("(2*a)*2") \
+  X("-(b^1.1)") \
+  X("a+b*(a+b)") \
+  X("(1.1+b)*(-3.3)") \
+  X("a+b-e*pi/5^6") \
+  X("a^b/e*pi-5+6") \
+  X("2.2*(a+b)") \
+  X("--a") \
+  X("a-+-b")
+#define N_ROWS 1000
+
+static bool same(double x, double y) {
+  return !std::memcmp(&x, &y, sizeof(x)) || (x != x && y != y);
+}
+
+/* "g" against "flep_eval" and "flep::Expression" on "s", over N_ROWS rows */
+template <class G>
+static int check(const char* s, G g) {
+  static double a[N_ROWS], b[N_ROWS], out[N_ROWS];
+  const double* cols[7] = {a, b, 0, 0, 0, 0, 0};
+  flep::Expression f(s);
+  for (int j = 0; j < N_ROWS; j++) {
+    a[j] = -3.1 + j * 0.0071;
+    b[j] = 2.9 - j * 0.0053;
+  }
+  f(cols, N_ROWS, out);
+  for (int j = 0; j < N_ROWS; j++) {
+    double ab[2] = {a[j], b[j]};
+    if (!same(g(ab), flep_eval(f.get(), ab)) || !same(f(ab), g(ab)) ||
+        !same(out[j], g(ab))) {
+      std::printf("\"%s\" at a=%.17g b=%.17g: %.17g, flep_eval %.17g\n",
+        s, a[j], b[j], g(ab), flep_eval(f.get(), ab));
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main() {
+  int bad = 0, n = 0;
+#define FLEP_CHECK(s) bad += check(s, FLEP_LITERAL(s)); n++;
+  FLEP_BUILT_IN(FLEP_CHECK)
+#undef FLEP_CHECK
+#if defined(__cpp_nontype_template_args) && \
+  __cpp_nontype_template_args >= 201911L
+  using namespace flep::literals;
+#define FLEP_CHECK(s) bad += check(s, s ## _flep); n++;
+  FLEP_BUILT_IN(FLEP_CHECK)
+#undef FLEP_CHECK
+#endif
+  try {
+    flep::Expression f("a+");
+    std::printf("flep::Expression parsed \"a+\"\n");
+    return 1;
+  } catch (const flep::Error&) {
+  }
+#ifdef FLEP_BAD_LITERAL
+  bad += check("a+", FLEP_LITERAL("a+"));
+#endif
+  std::printf("flep.hpp (C++%ld): %d of %d literals as flep_eval\n",
+    (long)__cplusplus / 100 % 100, n - bad, n);
+  return bad != 0;
+}
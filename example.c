@@ -19,22 +19,28 @@
 /* Test program. See README.txt for information on compiling and running.
  */
 #include <ctype.h>
+#include <dlfcn.h>
+#include <float.h>
 #include <math.h>
 #ifndef M_PI
 #define M_PI (3.14159265358979323846264338327950288)
 #endif
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 #include "flep.h"
+#include "flep_cache.h"
+#include "flep_pool.h"
 
 #define N_BUILT_IN 27
+#define BUFLEN 512
 /* These expressions were obtained from the lists provided in 
  * Arash Parkow's Mathematical Expression Parser Benchmark.
  * http://https://github.com/ArashPartow/math-parser-benchmark-project
  */
-const char* built_in[] = {
+const char* built_in[N_BUILT_IN] = {
   "sin(2.2 * a) + cos(pi / b)",
   "1 - sin(2.2 * a) + cos(pi / b)",
   "sqrt(3 + sin(2.2 * a) + cos(pi / b) / 3.3)",
@@ -157,31 +163,1118 @@ double compare(const struct FLEP* flep, double (*nat)(double*)) {
   return relerr / n;
 }
 
-double benchmark(const struct FLEP* flep, double (*nat)(volatile double*)) {
+/* Same as "compare", for "flep_evalf" */
+double comparef(const struct FLEP* flep, double (*nat)(double*)) {
+  double a, b, x, y, relerr = 0;
+  int n = 0;
+  for (a = 0.1; a <= 3.0; a += 0.2)
+  for (b = 0.2; b <= 3.0; b += 0.2) {
+    double ab[2];
+    float abf[2];
+    ab[0] = a; ab[1] = b;
+    abf[0] = (float)a; abf[1] = (float)b;
+    n++;
+    x = flep_evalf(flep, abf);
+    y = nat(ab);
+    relerr += fabs(y ? (x-y)/y : 0);
+  }
+  return relerr / n;
+}
+
+double time_scalar(const struct FLEP* flep, FLEPFunc eval) {
   int i, s1, u1, s2, u2;
-  double ab[2] = {1.1, 2.2}, time_flep, time_nat;
+  double ab[2] = {1.1, 2.2};
   volatile double *pab = ab;
 
   for (i = 0; i < N_DISCARD; i++) {
-    *pkeep += flep_eval(flep, (double*)pab);
+    *pkeep += eval(flep, (double*)pab);
     {double x = ab[0]; ab[0] = ab[1]; ab[1] = x;}
   }
   time_wrapper(&s1, &u1);
   for (i = 0; i < N_FOR_BENCH; i++) {
-    *pkeep += flep_eval(flep, ab);
+    *pkeep += eval(flep, ab);
     {double x = ab[0]; ab[0] = ab[1]; ab[1] = x;}
   }
   time_wrapper(&s2, &u2);
-  time_flep = (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+  return (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+}
+
+double benchmark(const struct FLEP* flep, FLEPFunc eval,
+  double (*nat)(volatile double*)) {
+  double ab[2] = {1.1, 2.2}, time_flep, time_nat;
+  volatile double *pab = ab;
+  time_flep = time_scalar(flep, eval);
   time_nat = nat(pab);
   return time_flep / time_nat;
 }
 
+/* Native code must give the very same results as the interpreter */
+void check_jit(const struct FLEP* flep, FLEPFunc jit) {
+  double ab[2];
+  for (ab[0] = 0.1; ab[0] <= 3.0; ab[0] += 0.2)
+  for (ab[1] = 0.2; ab[1] <= 3.0; ab[1] += 0.2) {
+    double x = flep_eval(flep, ab), y = jit(flep, ab);
+    if (x != y && x == x) {
+      printf("flep_jit differs from flep_eval, aborting.\n");
+      exit(1);
+    }
+  }
+}
+
+/* Same rows as "time_scalar", evaluated N_BATCH at a time */
+#define N_BATCH 1000
+double time_batch(const struct FLEP* flep) {
+  static double a[N_BATCH], b[N_BATCH], out[N_BATCH];
+  const double* cols[7] = {0, 0, 0, 0, 0, 0, 0};
+  int i, s1, u1, s2, u2;
+  for (i = 0; i < N_BATCH; i++) {
+    a[i] = (i % 2) ? 2.2 : 1.1;
+    b[i] = (i % 2) ? 1.1 : 2.2;
+  }
+  cols[0] = a; cols[1] = b;
+  flep_eval_batch(flep, cols, N_BATCH, out);
+  for (i = 0; i < N_BATCH; i++) {
+    double ab[2];
+    ab[0] = a[i]; ab[1] = b[i];
+    if (out[i] != flep_eval(flep, ab) && out[i] == out[i]) {
+      printf("flep_eval_batch differs from flep_eval, aborting.\n");
+      exit(1);
+    }
+  }
+  time_wrapper(&s1, &u1);
+  for (i = 0; i < N_FOR_BENCH / N_BATCH; i++) {
+    flep_eval_batch(flep, cols, N_BATCH, out);
+    *pkeep += out[N_BATCH-1];
+  }
+  time_wrapper(&s2, &u2);
+  return (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+}
+
+/* A sign right after another sign, e.g. "--a", once compiled to a binary
+ * minus with a single operand, which corrupted the heap
+ */
+#define N_SIGNS 5
+void check_signs(void) {
+  static const char* exprs[N_SIGNS] = {
+    "--a", "+-a", "a-+-b", "+--a*b", "b*--a"};
+  static double a[N_BATCH], b[N_BATCH], out[N_BATCH];
+  const double* cols[7] = {0, 0, 0, 0, 0, 0, 0};
+  int i, j;
+  for (j = 0; j < N_BATCH; j++) {
+    a[j] = 0.1 + j * 0.0029;
+    b[j] = 2.9 - j * 0.0037;
+  }
+  cols[0] = a; cols[1] = b;
+  for (i = 0; i < N_SIGNS; i++) {
+    const struct FLEP* f = flep_parse(exprs[i], 0, 0);
+    if (!f) {
+      printf("Failed to parse \"%s\", aborting.\n", exprs[i]);
+      exit(1);
+    }
+    flep_eval_batch(f, cols, N_BATCH, out);
+    for (j = 0; j < N_BATCH; j++) {
+      double ab[2], x;
+      ab[0] = a[j]; ab[1] = b[j];
+      switch (i) {
+	case 0: x = a[j]; break;
+	case 1: x = -a[j]; break;
+	case 2: x = a[j] + b[j]; break;
+	case 3: x = a[j] * b[j]; break;
+	default: x = b[j] * a[j];
+      }
+      if (flep_eval(f, ab) != x || out[j] != x) {
+	printf("\"%s\" gives %g rather than %g, aborting.\n", exprs[i],
+	  flep_eval(f, ab), x);
+	exit(1);
+      }
+    }
+    flep_free(f);
+  }
+}
+
+/* Write to "s" a sum of terms like those of fitted polynomials and
+ * piecewise functions, "n" tokens long (give or take a term).
+ */
+int synthetic(char* s, int n) {
+  static const char* term[] = {
+    "+%.3f*x^3", "-%.3f/%.3f*x*y", "+%.3f*abs(a-%.3f)",
+    "-%.3f*(b+%.3f)^2", "+sin(%.3f*z)/%.3f", "+(%.3f-1/%.3f)*w"};
+  static const int ntok[] = {6, 8, 9, 10, 9, 10};
+  int i, k = 0, len = sprintf(s, "%.3f", 0.5);
+  for (i = 1; i < n; k++) {
+    double c = 1 + (k % 97) * 0.125, d = 2 + (k % 13) * 0.25;
+    len += sprintf(s + len, term[k % 6], c, d);
+    i += ntok[k % 6];
+  }
+  return len;
+}
+
+/* Compile synthetic expressions of 1k to 100k tokens, print tokens/us */
+void time_compile(void) {
+  int n, i;
+  printf("\nCompile throughput of synthetic expressions\n"
+    " %7s | %9s | %9s\n", "tokens", "ms/parse", "tokens/us");
+  for (n = 1000; n <= 100000; n *= 10) {
+    char* s = (char*)malloc(16 * n);
+    int reps = 1000000 / n, s1, u1, s2, u2;
+    double t;
+    synthetic(s, n);
+    time_wrapper(&s1, &u1);
+    for (i = 0; i < reps; i++) {
+      const struct FLEP* f = flep_parse(s, 0, 0);
+      if (!f) {
+	printf("Failed to parse synthetic expression, aborting.\n");
+	exit(1);
+      }
+      flep_free(f);
+    }
+    time_wrapper(&s2, &u2);
+    t = ((double)(u2 - u1) + 1e6 * (double)(s2 - s1)) / reps;
+    printf(" %7d | %9.3f | %9.1f\n", n, t / 1000, n / t);
+    free(s);
+  }
+}
+
+/* Compile "n" small expressions over and over, print expressions/s */
+void time_bulk(const char** exprs, int n) {
+  int i, j, reps = N_FOR_BENCH / n, s1, u1, s2, u2;
+  size_t bytes = 0;
+  double t;
+  for (i = 0; i < n; i++) bytes += strlen(exprs[i]);
+  time_wrapper(&s1, &u1);
+  for (j = 0; j < reps; j++) {
+    for (i = 0; i < n; i++) {
+      const struct FLEP* f = flep_parse(exprs[i], 0, 0);
+      if (!f) {
+	printf("Failed to parse \"%s\", aborting.\n", exprs[i]);
+	exit(1);
+      }
+      flep_free(f);
+    }
+  }
+  time_wrapper(&s2, &u2);
+  t = (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+  printf("\nBulk compilation: %.2f million expressions/s, %.1f MB/s\n",
+    (double)reps * n / t, (double)reps * bytes / t);
+}
+
+/* Compile the built-in expressions over and over, with and without a
+ * cache (of the default flags, with extra blanks to be normalized away)
+ */
+#define N_CACHE 1000
+void time_cache(void) {
+  struct FLEPCache* cache = flep_cache_new(1 << 20, 0);
+  struct FLEPCacheStats st;
+  const struct FLEP* f;
+  double t[2];
+  int i, j, k, s1, u1, s2, u2;
+  char spaced[N_BUILT_IN][BUFLEN];
+  for (i = 0; i < N_BUILT_IN; i++) {
+    sprintf(spaced[i], " %s ", built_in[i]);
+  }
+  for (k = 0; k < 2; k++) {
+    time_wrapper(&s1, &u1);
+    for (j = 0; j < N_CACHE; j++) {
+      for (i = 0; i < N_BUILT_IN; i++) {
+	if (k) {
+	  const char* s = (j % 2) ? spaced[i] : built_in[i];
+	  flep_cache_release(cache, flep_cache_get(cache, s, 0, 0));
+	} else {
+	  flep_free(flep_parse(built_in[i], 0, 0));
+	}
+      }
+    }
+    time_wrapper(&s2, &u2);
+    t[k] = (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+  }
+  flep_cache_stats(cache, &st);
+  if (st.misses != N_BUILT_IN || st.entries != N_BUILT_IN) {
+    printf("flep_cache missed cached expressions, aborting.\n");
+    exit(1);
+  }
+  f = flep_cache_get(cache, "a\v+ b", 0, 0); /* as "a+b" */
+  if (!f || flep_cache_get(cache, "a\240+b", 0, 0)) { /* no-break space */
+    printf("flep_cache took other blanks than flep_parse, aborting.\n");
+    exit(1);
+  }
+  flep_cache_release(cache, f);
+  printf("\nCompile through flep_cache: %.2f of the time of flep_parse"
+    " (%lu hits, %lu misses, %lu bytes)\n",
+    t[1] / t[0], st.hits, st.misses, (unsigned long)st.bytes);
+  flep_cache_free(cache);
+}
+
+/* Serialize the built-in expressions one after the other in a buffer,
+ * then time loading them back against parsing them again
+ */
+void time_load(void) {
+  const struct FLEP* f[N_BUILT_IN];
+  size_t size = 0, used;
+  char *image, *p;
+  double t[2], ab[2] = {1.1, 2.2};
+  int i, j, k, s1, u1, s2, u2;
+  for (i = 0; i < N_BUILT_IN; i++) {
+    f[i] = flep_parse(built_in[i], 0, 0);
+    size += flep_serialize(f[i], 0, 0);
+  }
+  image = (char*)malloc(size);
+  for (i = 0, p = image; i < N_BUILT_IN; i++) {
+    p += flep_serialize(f[i], p, image + size - p);
+  }
+  for (i = 0, p = image; i < N_BUILT_IN; i++, p += used) {
+    const struct FLEP* g = flep_load(p, image + size - p, &used);
+    if (!g || flep_eval(g, ab) != flep_eval(f[i], ab)) {
+      printf("flep_load differs from flep_parse, aborting.\n");
+      exit(1);
+    }
+    flep_free(f[i]);
+  }
+  for (k = 0; k < 2; k++) {
+    time_wrapper(&s1, &u1);
+    for (j = 0; j < N_CACHE; j++) {
+      for (i = 0, p = image; i < N_BUILT_IN; i++, p += used) {
+	if (k) {
+	  *pkeep += (flep_load(p, image + size - p, &used) != 0);
+	} else {
+	  flep_free(flep_parse(built_in[i], 0, 0));
+	}
+      }
+    }
+    time_wrapper(&s2, &u2);
+    t[k] = (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+  }
+  printf("Load from serialized images: %.3f of the time of flep_parse"
+    " (%lu bytes)\n", t[1] / t[0], (unsigned long)size);
+  free(image);
+}
+
+/* Corrupt images must be refused: one cut short, and one whose header
+ * claims counts of constants and opcodes adding up, as ints, to its size
+ * wrapped around 2^32. The header is read as the ints it starts with:
+ * magic, version, order, size, heap, nd, nc, nt.
+ */
+void check_load(void) {
+  const struct FLEP* f = flep_parse("a+1", 0, 0);
+  size_t size = flep_serialize(f, 0, 0), big = size + (1 << 29);
+  double image[64];
+  char* wrap;
+  if (size > sizeof(image)) {
+    printf("Image of \"a+1\" unexpectedly large, aborting.\n");
+    exit(1);
+  }
+  flep_serialize(f, image, size);
+  flep_free(f);
+  if (!flep_load(image, size, 0) || flep_load(image, size - 8, 0) ||
+      flep_load(image, 16, 0)) {
+    printf("flep_load accepted a truncated image, aborting.\n");
+    exit(1);
+  }
+  wrap = (char*)malloc(big); /* pages past the header are never touched */
+  if (!wrap) return;
+  memcpy(wrap, image, size);
+  ((int*)wrap)[3] += 1 << 29;
+  ((int*)wrap)[5] += 1 << 29; /* 2^32 more bytes of constants */
+  ((int*)wrap)[7] += 1 << 27; /* 2^29 more bytes of opcodes */
+  if (flep_load(wrap, big, 0)) {
+    printf("flep_load accepted an image with a wrapped size, aborting.\n");
+    exit(1);
+  }
+  free(wrap);
+}
+
+/* Compile the built-in expressions over and over into an arena, emptied
+ * after each round, against allocating and freeing each one
+ */
+void time_arena(void) {
+  static double mem[4096];
+  struct FLEPArena arena;
+  double t[2];
+  int i, j, k, s1, u1, s2, u2, error;
+  arena.base = (char*)mem;
+  arena.size = sizeof(mem);
+  for (k = 0; k < 2; k++) {
+    time_wrapper(&s1, &u1);
+    for (j = 0; j < N_CACHE; j++) {
+      arena.used = 0;
+      for (i = 0; i < N_BUILT_IN; i++) {
+	if (k) {
+	  flep_parse_arena(&arena, built_in[i], 0, 0, 0);
+	} else {
+	  flep_free(flep_parse(built_in[i], 0, 0));
+	}
+      }
+    }
+    time_wrapper(&s2, &u2);
+    t[k] = (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+  }
+  arena.size = arena.used;
+  if (flep_parse_arena(&arena, built_in[0], 0, &error, 0) ||
+      error != FLEP_NOMEMORY) {
+    printf("flep_parse_arena overflowed its arena, aborting.\n");
+    exit(1);
+  }
+  printf("Compile into an arena: %.2f of the time of flep_parse"
+    " (%lu bytes)\n", t[1] / t[0], (unsigned long)arena.used);
+}
+
+/* Evaluate all built-in expressions as outputs of one program, against
+ * evaluating each on its own
+ */
+void time_many(void) {
+  const struct FLEP *many = flep_parse_many(built_in, N_BUILT_IN, 0, 0, 0, 0);
+  const struct FLEP* f[N_BUILT_IN];
+  static double a[N_BATCH], b[N_BATCH], out[N_BUILT_IN * N_BATCH];
+  const double* cols[7] = {0, 0, 0, 0, 0, 0, 0};
+  double t[2], ab[2] = {1.1, 2.2}, y[N_BUILT_IN];
+  int i, j, k, s1, u1, s2, u2;
+  for (i = 0; i < N_BATCH; i++) {
+    a[i] = 0.1 + i * 0.003;
+    b[i] = 2.9 - i * 0.0027;
+  }
+  cols[0] = a; cols[1] = b;
+  flep_eval_batch(many, cols, N_BATCH, out);
+  for (i = 0; i < N_BUILT_IN; i++) {
+    f[i] = flep_parse(built_in[i], 0, 0);
+    for (j = 0; j < N_BATCH; j++) {
+      double x, z = out[i * N_BATCH + j];
+      ab[0] = a[j]; ab[1] = b[j];
+      flep_eval_many(many, ab, y);
+      x = flep_eval(f[i], ab);
+      if ((x != y[i] && x == x) || (x != z && x == x)) {
+	printf("flep_eval_many differs from flep_eval, aborting.\n");
+	exit(1);
+      }
+    }
+  }
+  for (k = 0; k < 2; k++) {
+    time_wrapper(&s1, &u1);
+    for (j = 0; j < N_FOR_BENCH / 10; j++) {
+      if (k) {
+	flep_eval_many(many, ab, y);
+      } else {
+	for (i = 0; i < N_BUILT_IN; i++) y[i] = flep_eval(f[i], ab);
+      }
+      *pkeep += y[N_BUILT_IN - 1];
+      {double x = ab[0]; ab[0] = ab[1]; ab[1] = x;}
+    }
+    time_wrapper(&s2, &u2);
+    t[k] = (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+  }
+  printf("All expressions by flep_eval_many: %.2f of the time of flep_eval\n",
+    t[1] / t[0]);
+  for (i = 0; i < N_BUILT_IN; i++) flep_free(f[i]);
+  flep_free(many);
+}
+
+/* Evaluate the last built-in expression, and the first four as outputs of
+ * one program, over N_POOL rows with 1 to 8 threads of a pool; print rows/us
+ */
+#define N_POOL (1 << 20)
+void time_pool(void) {
+  const struct FLEP* f[2];
+  const double* cols[7] = {0, 0, 0, 0, 0, 0, 0};
+  double *a = (double*)malloc(N_POOL * sizeof(double));
+  double *b = (double*)malloc(N_POOL * sizeof(double));
+  double *out = (double*)malloc(4 * (size_t)N_POOL * sizeof(double));
+  double *ref = (double*)malloc(4 * (size_t)N_POOL * sizeof(double));
+  struct FLEPPool* pool = flep_pool_new(8);
+  int i, k, t, s1, u1, s2, u2;
+  for (i = 0; i < N_POOL; i++) {
+    a[i] = 0.1 + (i % 1000) * 0.003;
+    b[i] = 2.9 - (i % 997) * 0.0027;
+  }
+  cols[0] = a; cols[1] = b;
+  f[0] = flep_parse(built_in[N_BUILT_IN - 1], 0, 0);
+  f[1] = flep_parse_many(built_in, 4, 0, 0, 0, 0);
+  for (k = 0; k < 2; k++) {
+    size_t bytes = flep_outputs(f[k]) * (size_t)N_POOL * sizeof(double);
+    flep_eval_batch(f[k], cols, N_POOL, ref);
+    flep_pool_eval(pool, f[k], cols, N_POOL, out, 0); /* touch every page */
+    printf("%s over %d rows by a pool, rows/us:",
+      k ? "Four expressions" : "Last expression", N_POOL);
+    for (t = 1; t <= 8; t *= 2) {
+      time_wrapper(&s1, &u1);
+      flep_pool_eval(pool, f[k], cols, N_POOL, out, t);
+      time_wrapper(&s2, &u2);
+      if (memcmp(out, ref, bytes)) {
+	printf("\nflep_pool_eval differs from flep_eval_batch, aborting.\n");
+	exit(1);
+      }
+      printf(" %.1f (%d threads)", N_POOL / ((double)(u2 - u1) +
+	1e6 * (double)(s2 - s1)), t);
+    }
+    printf("\n");
+    flep_free(f[k]);
+  }
+  flep_pool_free(pool);
+  free(a);
+  free(b);
+  free(out);
+  free(ref);
+}
+
+/* Gradients of the built-in expressions by "flep_eval_grad", against
+ * central differences (the 5 calls of "flep_eval" they replace): print
+ * the time ratio and the largest relative difference
+ */
+void time_grad(void) {
+  double t[2] = {0, 0}, worst = 0;
+  int i, j, k, s1, u1, s2, u2;
+  for (i = 0; i < N_BUILT_IN; i++) {
+    const struct FLEP* f = flep_parse(built_in[i], 0, 0);
+    double ab[2] = {1.1, 2.2}, g[7], fd[2], h = 1e-6;
+    if (flep_eval_grad(f, ab, g) != flep_eval(f, ab)) {
+      printf("flep_eval_grad differs from flep_eval, aborting.\n");
+      exit(1);
+    }
+    for (j = 0; j < 2; j++) {
+      double s = ab[j], e = h * (fabs(s) + 1), p, m;
+      ab[j] = s + e; p = flep_eval(f, ab);
+      ab[j] = s - e; m = flep_eval(f, ab);
+      ab[j] = s;
+      fd[j] = (p - m) / (2 * e);
+      if (fabs(fd[j] - g[j]) / (fabs(g[j]) + 1) > worst) {
+	worst = fabs(fd[j] - g[j]) / (fabs(g[j]) + 1);
+      }
+    }
+    for (k = 0; k < 2; k++) {
+      time_wrapper(&s1, &u1);
+      for (j = 0; j < N_FOR_BENCH / 100; j++) {
+	if (k) {
+	  *pkeep += flep_eval_grad(f, ab, g) + g[1];
+	} else {
+	  double x = flep_eval(f, ab), e = h * 2.2;
+	  ab[0] = 1.1 + h * 2.1; x += flep_eval(f, ab);
+	  ab[0] = 1.1 - h * 2.1; x += flep_eval(f, ab);
+	  ab[0] = 1.1;
+	  ab[1] = 2.2 + e; x += flep_eval(f, ab);
+	  ab[1] = 2.2 - e; x += flep_eval(f, ab);
+	  ab[1] = 2.2;
+	  *pkeep += x;
+	}
+      }
+      time_wrapper(&s2, &u2);
+      t[k] += (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+    }
+    flep_free(f);
+  }
+  printf("Gradients by flep_eval_grad: %.2f of the time of central "
+    "differences (relative difference up to %.1e)\n", t[1] / t[0], worst);
+}
+
+/* Accuracy of single precision by "comparef" (mean and worst over the
+ * built-in expressions), and its time relative to double precision,
+ * scalar and batch
+ */
+void time_float(void) {
+  static double a[N_BATCH], b[N_BATCH], out[N_BATCH];
+  static float af[N_BATCH], bf[N_BATCH], outf[N_BATCH];
+  const double* cols[7] = {0, 0, 0, 0, 0, 0, 0};
+  const float* colsf[7] = {0, 0, 0, 0, 0, 0, 0};
+  double t[4] = {0, 0, 0, 0}, err, worst = 0, mean = 0;
+  int i, j, k, s1, u1, s2, u2, iworst = 0;
+  for (j = 0; j < N_BATCH; j++) {
+    a[j] = af[j] = (float)(0.1 + j * 0.003);
+    b[j] = bf[j] = (float)(2.9 - j * 0.0027);
+  }
+  cols[0] = a; cols[1] = b;
+  colsf[0] = af; colsf[1] = bf;
+  for (i = 0; i < N_BUILT_IN; i++) {
+    const struct FLEP* f = flep_parse(built_in[i], 0, 0);
+    err = comparef(f, native_eval[i]);
+    mean += err / N_BUILT_IN;
+    if (err > worst) {
+      worst = err;
+      iworst = i;
+    }
+    flep_eval_batchf(f, colsf, N_BATCH, outf);
+    for (j = 0; j < N_BATCH; j++) {
+      float abf[2], x;
+      abf[0] = af[j]; abf[1] = bf[j];
+      x = flep_evalf(f, abf);
+      if (x != outf[j] && x == x) {
+	printf("flep_eval_batchf differs from flep_evalf, aborting.\n");
+	exit(1);
+      }
+    }
+    for (k = 0; k < 4; k++) {
+      time_wrapper(&s1, &u1);
+      for (j = 0; j < N_FOR_BENCH / N_BATCH / 10; j++) {
+	int r;
+	switch (k) {
+	  case 0:
+	    for (r = 0; r < N_BATCH; r++) {
+	      double ab[2];
+	      ab[0] = a[r]; ab[1] = b[r];
+	      out[r] = flep_eval(f, ab);
+	    }
+	    break;
+	  case 1:
+	    for (r = 0; r < N_BATCH; r++) {
+	      float abf[2];
+	      abf[0] = af[r]; abf[1] = bf[r];
+	      outf[r] = flep_evalf(f, abf);
+	    }
+	    break;
+	  case 2: flep_eval_batch(f, cols, N_BATCH, out); break;
+	  case 3: flep_eval_batchf(f, colsf, N_BATCH, outf); break;
+	}
+	*pkeep += out[N_BATCH - 1] + outf[N_BATCH - 1];
+      }
+      time_wrapper(&s2, &u2);
+      t[k] += (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+    }
+    flep_free(f);
+  }
+  printf("Single precision: %.2f of the time of double, %.2f in batch\n"
+    "  relative error %.1e%% on average, up to %.1e%% for %s\n",
+    t[1] / t[0], t[3] / t[2], 100 * mean, 100 * worst, built_in[iworst]);
+}
+
+/* Fix "a" in each built-in expression by "flep_specialize" and sweep "b":
+ * print the time and memory relative to the original expression, and the
+ * largest relative difference of results (which only rewrites like x^2 to
+ * x*x, being more accurate, may cause)
+ */
+void time_specialize(void) {
+  double t[2] = {0, 0}, worst = 0;
+  size_t bytes[2] = {0, 0};
+  int i, j, k, s1, u1, s2, u2;
+  for (i = 0; i < N_BUILT_IN; i++) {
+    const struct FLEP* f[2];
+    double ab[2] = {1.1, 0};
+    f[0] = flep_parse(built_in[i], 0, 0);
+    f[1] = flep_specialize(f[0], 1, ab);
+    for (j = 0; j < 1000; j++) {
+      double x, y;
+      ab[1] = 0.05 + j * 0.003;
+      x = flep_eval(f[0], ab);
+      y = flep_eval(f[1], ab);
+      if (x != y && fabs(x - y) > worst * fabs(x)) {
+	worst = fabs(x - y) / fabs(x);
+      }
+    }
+    if (worst > 1e-12) {
+      printf("flep_specialize differs from flep_eval, aborting.\n");
+      exit(1);
+    }
+    for (k = 0; k < 2; k++) {
+      bytes[k] += flep_memory(f[k]);
+      time_wrapper(&s1, &u1);
+      for (j = 0; j < N_FOR_BENCH / 10; j++) {
+	ab[1] = 0.05 + (j & 1023) * 0.003;
+	*pkeep += flep_eval(f[k], ab);
+      }
+      time_wrapper(&s2, &u2);
+      t[k] += (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+    }
+    flep_free(f[1]);
+    flep_free(f[0]);
+  }
+  printf("Specialized on \"a\": %.2f of the time, %.2f of the memory "
+    "(relative difference up to %.1e)\n", t[1] / t[0],
+    (double)bytes[1] / bytes[0], worst);
+}
+
+/* Evaluate an expression with costly terms in "a" and "b" as only "x"
+ * changes, by "flep_context_eval" and by "flep_eval"; print the time ratio
+ */
+void time_context(void) {
+  const struct FLEP* f = flep_parse("exp(a/3)*log(b+2)^1.7 + a^(b/3)*sin(x)"
+    " + sqrt(a*b)/(1 + x*x) - tan(b)*cos(a)*x", 0, 0);
+  struct FLEPContext* c = flep_context_new(f);
+  double t[2], val[7] = {1.3, 2.1, 0, 0.5, 0, 0, 0};
+  int i, k, s1, u1, s2, u2;
+  for (k = 0; k < 3; k++) {
+    val[0] = 1.3;
+    time_wrapper(&s1, &u1);
+    for (i = 0; i < N_FOR_BENCH / 10; i++) {
+      double x;
+      val[3] = 0.5 + (i & 255) * 0.01;
+      if ((i & 1023) == 0) val[0] += 0.001; /* now and then, "a" too */
+      x = k ? flep_context_eval(c, val, (i & 1023) ? 8 : 9) :
+	flep_eval(f, val);
+      if (k == 2 && x != flep_eval(f, val)) {
+	printf("flep_context_eval differs from flep_eval, aborting.\n");
+	exit(1);
+      }
+      *pkeep += x;
+    }
+    time_wrapper(&s2, &u2);
+    if (k < 2) t[k] = (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+  }
+  printf("Incremental evaluation as only \"x\" changes: %.2f of the time "
+    "of flep_eval\n", t[1] / t[0]);
+  flep_context_free(c);
+  flep_free(f);
+}
+
+/* Records with the variables "a" and "b" among other fields */
+struct Particle {
+  int id;
+  double mass; /* a */
+  double v[3]; /* b is v[1] */
+  char tag[8];
+};
+
+/* Bind each built-in expression to "struct Particle", check evaluation of
+ * records against that of gathered variables, and time both
+ */
+void time_records(void) {
+  static struct Particle p[N_BATCH];
+  static double a[N_BATCH], b[N_BATCH], out[N_BATCH], ref[N_BATCH];
+  const double* cols[7] = {0, 0, 0, 0, 0, 0, 0};
+  struct FLEPLayout layout;
+  double t[4];
+  int i, j, k, s1, u1, s2, u2;
+  memset(&layout, 0, sizeof(layout));
+  layout.offset[0] = offsetof(struct Particle, mass);
+  layout.offset[1] = offsetof(struct Particle, v) + sizeof(double);
+  layout.stride = sizeof(struct Particle);
+  for (i = 0; i < N_BATCH; i++) {
+    p[i].id = i;
+    p[i].mass = 0.1 + i * 0.003;
+    p[i].v[1] = 2.9 - i * 0.0027;
+  }
+  cols[0] = a; cols[1] = b;
+  memset(t, 0, sizeof(t));
+  for (i = 0; i < N_BUILT_IN; i++) {
+    const struct FLEP *f = flep_parse(built_in[i], 0, 0);
+    const struct FLEP *g = flep_bind(f, &layout);
+    FLEPFunc jit = flep_jit(g);
+    for (j = 0; j < N_BATCH; j++) {
+      double ab[2], x;
+      ab[0] = p[j].mass; ab[1] = p[j].v[1];
+      x = flep_eval(f, ab);
+      if ((x != flep_eval_record(g, p + j) ||
+	  x != jit(g, (double*)(p + j))) && x == x) {
+	printf("flep_eval_record differs from flep_eval, aborting.\n");
+	exit(1);
+      }
+    }
+    flep_eval_records(g, p, N_BATCH, out);
+    for (j = 0; j < N_BATCH; j++) {
+      a[j] = p[j].mass;
+      b[j] = p[j].v[1];
+    }
+    flep_eval_batch(f, cols, N_BATCH, ref);
+    if (memcmp(out, ref, sizeof(out))) {
+      printf("flep_eval_records differs from flep_eval_batch, aborting.\n");
+      exit(1);
+    }
+    if (!i) { /* each given what the other expects: all NaN */
+      flep_eval_batch(g, cols, N_BATCH, out);
+      flep_eval_records(f, p, N_BATCH, ref);
+      for (j = 0; j < N_BATCH; j++) {
+	if (out[j] == out[j] || ref[j] == ref[j] || flep_stride(f) ||
+	    flep_stride(g) != sizeof(struct Particle)) {
+	  printf("Misused bound expression not refused, aborting.\n");
+	  exit(1);
+	}
+      }
+    }
+    for (k = 0; k < 4; k++) {
+      time_wrapper(&s1, &u1);
+      for (j = 0; j < N_FOR_BENCH / N_BATCH / 10; j++) {
+	int r;
+	switch (k) {
+	  case 0: /* gather each row, as callers of "flep_eval" must */
+	    for (r = 0; r < N_BATCH; r++) {
+	      double ab[2];
+	      ab[0] = p[r].mass; ab[1] = p[r].v[1];
+	      out[r] = flep_eval(f, ab);
+	    }
+	    break;
+	  case 1:
+	    for (r = 0; r < N_BATCH; r++) out[r] = flep_eval_record(g, p + r);
+	    break;
+	  case 2: /* gather columns, as callers of "flep_eval_batch" must */
+	    for (r = 0; r < N_BATCH; r++) {
+	      a[r] = p[r].mass;
+	      b[r] = p[r].v[1];
+	    }
+	    flep_eval_batch(f, cols, N_BATCH, out);
+	    break;
+	  case 3: flep_eval_records(g, p, N_BATCH, out); break;
+	}
+	*pkeep += out[N_BATCH - 1];
+      }
+      time_wrapper(&s2, &u2);
+      t[k] += (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+    }
+    flep_jit_free(jit);
+    flep_free(g);
+    flep_free(f);
+  }
+  printf("Records read in place: %.2f of the time of gathering for "
+    "flep_eval, %.2f for flep_eval_batch\n", t[1] / t[0], t[3] / t[2]);
+}
+
+/* Error of FLEP's own functions ("FLEP_APPROX") relative to the C library,
+ * in units of DBL_EPSILON, over the ranges of "compare" and of arguments
+ * in the built-in expressions, and for trigonometric functions near
+ * multiples of pi/2 up to 1e5, where they use their own reduction; then
+ * the time of the built-in expressions with them relative to without,
+ * scalar and batch
+ */
+void time_approx(void) {
+  static const char* fn[9] = {
+    "sin(a)", "cos(a)", "tan(a)", "exp(a)", "log(a)", "a^b",
+    "sin(a)", "cos(a)", "tan(a)"};
+  static const double range[6][4] = { /* a from, to; b from, to */
+    {-32, 32, 0, 0}, {-32, 32, 0, 0}, {-32, 32, 0, 0}, {-20, 20, 0, 0},
+    {0.001, 25, 0, 0}, {0.1, 10, -3, 3}};
+  static double a[N_BATCH], b[N_BATCH], out[2][N_BATCH];
+  const double* cols[7] = {0, 0, 0, 0, 0, 0, 0};
+  double t[4] = {0, 0, 0, 0}, ab[2] = {1.1, 2.2}, grad[7];
+  int i, j, k, s1, u1, s2, u2;
+  cols[0] = a; cols[1] = b;
+  printf("Own functions (FLEP_APPROX), error in units of DBL_EPSILON:");
+  for (i = 0; i < 9; i++) {
+    const struct FLEP* f[2];
+    FLEPFunc jit;
+    double worst = 0;
+    f[0] = flep_parse(fn[i], 0, 0);
+    f[1] = flep_parse_flags(fn[i], FLEP_APPROX, 0, 0);
+    jit = flep_jit(f[1]);
+    for (j = 0; j < N_BATCH; j++) {
+      if (i < 6) {
+	a[j] = range[i][0] + (range[i][1] - range[i][0]) * j / N_BATCH;
+	b[j] = range[i][2] + (range[i][3] - range[i][2]) * (j * 7 % N_BATCH)
+	  / N_BATCH;
+      } else { /* the nearest doubles to k pi/2, give or take one ulp */
+	a[j] = floor((j + 1.0) * (1e5 / (M_PI / 2)) / N_BATCH) * (M_PI / 2)
+	  * (1 + (j % 3 - 1) * DBL_EPSILON);
+	b[j] = 0;
+      }
+    }
+    flep_eval_batch(f[0], cols, N_BATCH, out[0]);
+    flep_eval_batch(f[1], cols, N_BATCH, out[1]);
+    for (j = 0; j < N_BATCH; j++) {
+      double x = out[1][j], y = out[0][j];
+      ab[0] = a[j]; ab[1] = b[j];
+      if (x != flep_eval(f[1], ab) || x != jit(f[1], ab) ||
+	x != flep_eval_grad(f[1], ab, grad)) {
+	printf("\nFLEP_APPROX differs between flep_eval_batch, flep_eval, "
+	  "flep_jit and flep_eval_grad, aborting.\n");
+	exit(1);
+      }
+      if (y && fabs((x - y) / y) / DBL_EPSILON > worst) {
+	worst = fabs((x - y) / y) / DBL_EPSILON;
+      }
+    }
+    printf("%s %s %.1f", i == 6 ? "\n  near multiples of pi/2:" :
+      i ? "," : "", fn[i], worst);
+    flep_jit_free(jit);
+    flep_free(f[0]);
+    flep_free(f[1]);
+  }
+  for (i = 0; i < N_BUILT_IN; i++) {
+    for (k = 0; k < 4; k++) {
+      const struct FLEP* f = flep_parse_flags(built_in[i],
+	k & 1 ? FLEP_APPROX : 0, 0, 0);
+      for (j = 0; j < N_BATCH; j++) {
+	a[j] = 0.1 + j * 0.0029;
+	b[j] = 2.9 - j * 0.0027;
+      }
+      time_wrapper(&s1, &u1);
+      for (j = 0; j < N_FOR_BENCH / N_BATCH / 10; j++) {
+	if (k < 2) {
+	  int r;
+	  for (r = 0; r < N_BATCH; r++) {
+	    ab[0] = a[r]; ab[1] = b[r];
+	    out[0][r] = flep_eval(f, ab);
+	  }
+	} else {
+	  flep_eval_batch(f, cols, N_BATCH, out[0]);
+	}
+	*pkeep += out[0][N_BATCH - 1];
+      }
+      time_wrapper(&s2, &u2);
+      t[k] += (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+      flep_free(f);
+    }
+  }
+  printf("\n  built-in expressions take %.2f of the time with them, "
+    "%.2f in batch\n", t[1] / t[0], t[3] / t[2]);
+}
+
+/* "x" and "y" the same double, bit for bit (any NaN being the same) */
+int same(double x, double y) {
+  return !memcmp(&x, &y, sizeof(x)) || (x != x && y != y);
+}
+
+/* The built-in expressions, their program from "flep_parse_many" and one
+ * bound expression written out by "flep_emit_c" and "flep_emit_c_batch",
+ * compiled by the system's C compiler and loaded with "dlopen": results
+ * must be those of the interpreter bit for bit. Then the time of the
+ * compiled built-in expressions relative to the interpreter, scalar and
+ * batch. Skipped if "cc" cannot build a shared object.
+ */
+void time_emit(void) {
+  typedef double (*Scalar)(const double*);
+  typedef void (*Batch)(const double* const*, size_t, double*);
+  typedef void (*Many)(const double*, double*);
+  typedef void (*Records)(const void*, size_t, double*);
+  static struct Particle p[N_BATCH];
+  static double a[N_BATCH], b[N_BATCH], out[N_BUILT_IN * N_BATCH],
+    ref[N_BUILT_IN * N_BATCH];
+  const struct FLEP *f[N_BUILT_IN], *many, *bound;
+  const double* cols[7] = {0, 0, 0, 0, 0, 0, 0};
+  struct FLEPLayout layout;
+  Scalar scalar[N_BUILT_IN];
+  Batch batch[N_BUILT_IN], many_batch;
+  Many many_scalar;
+  Records records;
+  Scalar record;
+  double t[4] = {0, 0, 0, 0}, ab[2], y[N_BUILT_IN];
+  int i, j, k, s1, u1, s2, u2, ok;
+  char name[32];
+  void *so, *sym;
+  FILE* file = fopen("flep_emitted.c", "w");
+  memset(&layout, 0, sizeof(layout));
+  layout.offset[0] = offsetof(struct Particle, mass);
+  layout.offset[1] = offsetof(struct Particle, v) + sizeof(double);
+  layout.stride = sizeof(struct Particle);
+  many = flep_parse_many(built_in, N_BUILT_IN, 0, 0, 0, 0);
+  f[0] = flep_parse(built_in[0], 0, 0);
+  bound = flep_bind(f[0], &layout);
+  ok = file && flep_emit_c_header(file);
+  for (i = 0; i < N_BUILT_IN; i++) {
+    if (i) f[i] = flep_parse(built_in[i], 0, 0);
+    sprintf(name, "scalar%d", i);
+    ok = ok && flep_emit_c(f[i], name, file);
+    sprintf(name, "batch%d", i);
+    ok = ok && flep_emit_c_batch(f[i], name, file);
+  }
+  ok = ok && flep_emit_c(many, "many", file) &&
+    flep_emit_c_batch(many, "many_batch", file) &&
+    flep_emit_c(bound, "record", file) &&
+    flep_emit_c_batch(bound, "records", file);
+  if (file && fclose(file)) ok = 0;
+  if (!ok) {
+    printf("flep_emit_c failed to write \"flep_emitted.c\", aborting.\n");
+    exit(1);
+  }
+  if (system("cc -O2 -shared -fPIC -o flep_emitted.so flep_emitted.c -lm")
+    || !(so = dlopen("./flep_emitted.so", RTLD_NOW))) {
+    printf("Emitted C: skipped, \"cc\" failed to build a shared object\n");
+    remove("flep_emitted.c");
+    remove("flep_emitted.so");
+    for (i = 0; i < N_BUILT_IN; i++) flep_free(f[i]);
+    flep_free(many);
+    flep_free(bound);
+    return;
+  }
+  for (i = 0; i < N_BUILT_IN; i++) { /* as in "flep_jit", for ISO C */
+    sprintf(name, "scalar%d", i);
+    sym = dlsym(so, name);
+    memcpy(&scalar[i], &sym, sizeof(sym));
+    sprintf(name, "batch%d", i);
+    sym = dlsym(so, name);
+    memcpy(&batch[i], &sym, sizeof(sym));
+  }
+  sym = dlsym(so, "many");
+  memcpy(&many_scalar, &sym, sizeof(sym));
+  sym = dlsym(so, "many_batch");
+  memcpy(&many_batch, &sym, sizeof(sym));
+  sym = dlsym(so, "record");
+  memcpy(&record, &sym, sizeof(sym));
+  sym = dlsym(so, "records");
+  memcpy(&records, &sym, sizeof(sym));
+  for (j = 0; j < N_BATCH; j++) {
+    p[j].mass = a[j] = 0.1 + j * 0.0029;
+    p[j].v[1] = b[j] = 2.9 - j * 0.0027;
+  }
+  cols[0] = a; cols[1] = b;
+  for (i = 0; i < N_BUILT_IN; i++) {
+    batch[i](cols, N_BATCH, out);
+    flep_eval_batch(f[i], cols, N_BATCH, ref);
+    for (j = 0; j < N_BATCH; j++) {
+      ab[0] = a[j]; ab[1] = b[j];
+      ok = ok && same(scalar[i](ab), flep_eval(f[i], ab)) &&
+	same(out[j], ref[j]);
+    }
+  }
+  many_batch(cols, N_BATCH, out);
+  flep_eval_batch(many, cols, N_BATCH, ref);
+  for (j = 0; j < N_BUILT_IN * N_BATCH; j++) ok = ok && same(out[j], ref[j]);
+  for (j = 0; j < N_BATCH; j++) {
+    ab[0] = a[j]; ab[1] = b[j];
+    many_scalar(ab, out);
+    flep_eval_many(many, ab, y);
+    for (i = 0; i < N_BUILT_IN; i++) ok = ok && same(out[i], y[i]);
+  }
+  records(p, N_BATCH, out);
+  flep_eval_records(bound, p, N_BATCH, ref);
+  for (j = 0; j < N_BATCH; j++) {
+    ok = ok && same(out[j], ref[j]) &&
+      same(record((const double*)(p + j)), flep_eval_record(bound, p + j));
+  }
+  if (!ok) {
+    printf("Emitted C differs from flep_eval, aborting.\n");
+    exit(1);
+  }
+  for (i = 0; i < N_BUILT_IN; i++) {
+    for (k = 0; k < 4; k++) {
+      time_wrapper(&s1, &u1);
+      for (j = 0; j < N_FOR_BENCH / N_BATCH / 10; j++) {
+	int r;
+	switch (k) {
+	  case 0: case 1:
+	    for (r = 0; r < N_BATCH; r++) {
+	      ab[0] = a[r]; ab[1] = b[r];
+	      out[r] = k ? scalar[i](ab) : flep_eval(f[i], ab);
+	    }
+	    break;
+	  case 2: flep_eval_batch(f[i], cols, N_BATCH, out); break;
+	  case 3: batch[i](cols, N_BATCH, out); break;
+	}
+	*pkeep += out[N_BATCH - 1];
+      }
+      time_wrapper(&s2, &u2);
+      t[k] += (double)(u2 - u1) + 1e6 * (double)(s2 - s1);
+    }
+  }
+  printf("Emitted C (cc -O2), same results: %.2f of the time of flep_eval, "
+    "%.2f of flep_eval_batch\n", t[1] / t[0], t[3] / t[2]);
+  dlclose(so);
+  remove("flep_emitted.c");
+  remove("flep_emitted.so");
+  for (i = 0; i < N_BUILT_IN; i++) flep_free(f[i]);
+  flep_free(many);
+  flep_free(bound);
+}
+
+/* "flep_stream" run on column files of "a" and "b", raw and as text, for
+ * one and several of the built-in expressions, with two threads and with
+ * chunks of a few rows: its output must be that of "flep_eval_batch" bit
+ * for bit. Skipped if "./flep_stream" cannot be run.
+ */
+#define N_STREAM 70001 /* rows, over one default chunk and not a multiple */
+void check_stream(void) {
+  static const char* opts[] = {"", "", "-t", "-j 2", "-r 37", "-r 37 -j 2 -t"};
+  static const int nexpr[] = {1, N_BUILT_IN, 3, N_BUILT_IN, 1, 3};
+  double *a = (double*)malloc(N_STREAM * sizeof(double));
+  double *b = (double*)malloc(N_STREAM * sizeof(double));
+  double *ref = (double*)malloc(N_BUILT_IN * N_STREAM * sizeof(double));
+  const double* cols[7] = {0, 0, 0, 0, 0, 0, 0};
+  char cmd[4096];
+  int i, j, k, ok = 1;
+  FILE* file;
+  if (!a || !b || !ref) {
+    printf("Out of memory for flep_stream, aborting.\n");
+    exit(1);
+  }
+  for (j = 0; j < N_STREAM; j++) {
+    a[j] = 0.1 + j * 0.0029;
+    b[j] = 2.9 - j * 0.0027;
+  }
+  cols[0] = a; cols[1] = b;
+  ok = (file = fopen("flep_stream_a.bin", "wb")) &&
+    fwrite(a, sizeof(double), N_STREAM, file) == N_STREAM && !fclose(file);
+  ok = ok && (file = fopen("flep_stream_b.bin", "wb")) &&
+    fwrite(b, sizeof(double), N_STREAM, file) == N_STREAM && !fclose(file);
+  if (!ok) {
+    printf("Failed to write columns for flep_stream, aborting.\n");
+    exit(1);
+  }
+  for (k = 0; ok && k < (int)(sizeof(nexpr) / sizeof(*nexpr)); k++) {
+    const struct FLEP* f = flep_parse_many(built_in, nexpr[k], 0, 0, 0, 0);
+    int text = strstr(opts[k], "-t") != 0;
+    sprintf(cmd, "./flep_stream -a flep_stream_a.bin -b flep_stream_b.bin"
+      " -o flep_stream_out.bin %s --", opts[k]);
+    for (i = 0; i < nexpr[k]; i++) {
+      strcat(strcat(strcat(cmd, " \""), built_in[i]), "\"");
+    }
+    if (system(cmd)) {
+      flep_free(f);
+      if (!k) {
+	printf("flep_stream: skipped, \"./flep_stream\" failed to run\n");
+	break;
+      }
+      printf("flep_stream failed (%s), aborting.\n", opts[k]);
+      exit(1);
+    }
+    flep_eval_batch(f, cols, N_STREAM, ref);
+    flep_free(f);
+    ok = (file = fopen("flep_stream_out.bin", "rb")) != 0;
+    for (j = 0; ok && j < N_STREAM; j++) { /* rows in turn */
+      for (i = 0; ok && i < nexpr[k]; i++) {
+	double y;
+	ok = (text ? fscanf(file, "%lf", &y) == 1 :
+	  fread(&y, sizeof(y), 1, file) == 1) &&
+	  same(y, ref[i * N_STREAM + j]);
+      }
+    }
+    if (ok && (text ? fscanf(file, "%*s") != EOF : fgetc(file) != EOF)) {
+      ok = 0; /* more than expected */
+    }
+    if (file) fclose(file);
+    if (!ok) {
+      printf("flep_stream (%s) differs from flep_eval_batch, aborting.\n",
+	opts[k]);
+      exit(1);
+    }
+  }
+  if (ok) {
+    printf("flep_stream: same results as flep_eval_batch, raw and text, "
+      "with threads and small chunks\n");
+  }
+  remove("flep_stream_a.bin");
+  remove("flep_stream_b.bin");
+  remove("flep_stream_out.bin");
+  free(a);
+  free(b);
+  free(ref);
+}
+
+/* With FLEP built with FLEP_PROFILE, evaluate the built-in expressions and
+ * show which expressions and which opcodes took most of the time
+ */
+void show_profile(void) {
+  const struct FLEP *f[N_BUILT_IN], *top[3];
+  struct FLEPOpStats op[5];
+  struct FLEPStats s;
+  double ab[2] = {1.1, 2.2};
+  int i, j, n;
+  for (i = 0; i < N_BUILT_IN; i++) {
+    f[i] = flep_parse(built_in[i], 0, 0);
+    for (j = 0; j < N_FOR_BENCH / 100; j++) *pkeep += flep_eval(f[i], ab);
+  }
+  n = flep_stats_top(top, 3);
+  if (!n) {
+    printf("\nNo profiling statistics (build with CFLAGS=\"-O3 "
+      "-DFLEP_PROFILE\")\n");
+  } else {
+    printf("\nHottest expressions (of %d evaluations each):\n",
+      N_FOR_BENCH / 100);
+    for (i = 0; i < n; i++) {
+      for (j = 0; j < N_BUILT_IN && f[j] != top[i]; j++) continue;
+      flep_stats(top[i], &s);
+      if (j < N_BUILT_IN) {
+	printf(" %8.1f ticks/call  %s\n", s.ticks / s.calls, built_in[j]);
+      } else { /* evaluated earlier and never freed, e.g. in an arena */
+	printf(" %8.1f ticks/call  (expression at %p)\n", s.ticks / s.calls,
+	  (const void*)top[i]);
+      }
+    }
+    n = flep_stats_opcodes(op, 5);
+    printf("Hottest opcodes:\n");
+    for (i = 0; i < n; i++) {
+      printf(" %8.1f ticks/run  %s\n", op[i].ticks / op[i].count,
+	op[i].name);
+    }
+    flep_dump_stats(top[0]);
+  }
+  for (i = 0; i < N_BUILT_IN; i++) flep_free(f[i]);
+}
+
 int main(int argc, const char* argv[]) {
-  int i = 0, bad = 0, total = 0;
+  int i = 0, bad = 0, total = 0, nread = 0;
   FILE* infile = 0;
   const char* exp = 0;
-#define BUFLEN 512
+  const char** read = 0; /* expressions parsed from "infile" */
   char buf[BUFLEN];
 
   if (argc > 1) {
@@ -204,11 +1297,13 @@ int main(int argc, const char* argv[]) {
     printf(
   "Column A: relative error of FLEP to native implementation in %%\n"
   "Column B: relative time of FLEP to native implementation (ratio)\n"
-  "Column C: test expression\n\n"
-  " %3s%3s | %3s%2s | %10s\n"
-  " %6s | %5s |\n", 
-  "A", "", "B", "", "C",
-  "", "");
+  "Column C: relative time of FLEP JIT to native implementation (ratio)\n"
+  "Column D: relative time of FLEP batch to FLEP scalar evaluation (ratio)\n"
+  "Column E: test expression\n\n"
+  " %3s%3s | %3s%2s | %3s%2s | %3s%2s | %10s\n"
+  " %6s | %5s | %5s | %5s |\n", 
+  "A", "", "B", "", "C", "", "D", "", "E",
+  "", "", "", "");
   }
   for (;;i++) {
     if (infile) {
@@ -229,7 +1324,7 @@ int main(int argc, const char* argv[]) {
 	break;
       }
     } else {
-      if (i == N_BUILT_IN) return 0;
+      if (i == N_BUILT_IN) break;
       exp = built_in[i];
     }
     {
@@ -244,21 +1339,54 @@ int main(int argc, const char* argv[]) {
       }
       if (!infile) {
 	double ratio, percent_off = compare(flep, native_eval[i]);
+	FLEPFunc jit = flep_jit(flep);
 	printf(" %5.2f%% |", percent_off);
-	ratio = benchmark(flep, native_bench[i]);
+	ratio = benchmark(flep, flep_eval, native_bench[i]);
+	printf(" %5.2f |", ratio);
+	check_jit(flep, jit);
+	ratio = benchmark(flep, jit, native_bench[i]);
+	printf(" %5.2f |", ratio);
+	flep_jit_free(jit);
+	ratio = time_batch(flep) / time_scalar(flep, flep_eval);
 	printf(" %5.2f |", ratio);
 	printf(" %-s\n", exp);
       } else {
 	printf("\"%s\"\n", exp);
 	/* Uncomment the line below to see the RPN representation */
 	/* flep_dump(flep); */
+	read = (const char**)realloc((void*)read,
+	  (nread + 1) * sizeof(*read));
+	read[nread] = strcpy((char*)malloc(strlen(exp) + 1), exp);
+	nread++;
       }
       flep_free(flep);
     }
   }
-  if (infile) {
+  if (!infile) {
+    check_signs();
+    time_bulk(built_in, N_BUILT_IN);
+    time_compile();
+    time_cache();
+    check_load();
+    time_load();
+    time_arena();
+    time_many();
+    time_pool();
+    time_records();
+    time_grad();
+    time_float();
+    time_specialize();
+    time_context();
+    time_approx();
+    time_emit();
+    check_stream();
+    show_profile();
+  } else {
     printf("Successfully parsed %d of %d expressions from \"%s\"\n",
       total -bad, total, argv[1]);
+    if (nread) time_bulk(read, nread);
+    for (i = 0; i < nread; i++) free((void*)read[i]);
+    free((void*)read);
   }
   return 0;
 }
@@ -17,10 +17,13 @@
  */
 
 /* Parser and evaluator for math expressions
- * user interface is through flep_parse and flep_eval functions, ONLY.
+ * user interface is through the functions declared in flep.h, ONLY.
  * parser converts parethesized expressions into RNP.
  */
-#include <ctype.h>
+#if defined(__unix__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* mmap for the JIT, sincos */
+#endif
+#include <limits.h>
 #include <math.h>
 #ifndef M_PI
 #define M_PI (3.14159265358979323846264338327950288)
@@ -28,6 +31,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef FLEP_PROFILE
+#include <pthread.h>
+#include <time.h>
+#endif
 
 #include "flep.h"
 
@@ -59,7 +66,13 @@ define FLEP_BADSYNTAX
 define FLEP_BADTOKEN     
 define FLEP_EXPECTED_OPEN
 define FLEP_UNBALANCED
+define FLEP_NOMEMORY (after the runtime only opcodes below)
 */
+/* Runtime only opcodes, emitted by "flep_cse" */
+#define FLEP_STORE       24 /* copy top of stack to temporary */
+#define FLEP_LOAD        25 /* push temporary */
+#define FLEP_SINCOS      26 /* sin and cos of top, one of them to temporary */
+#define FLEP_OUTPUT      28 /* pop top of stack to an output */
 
 
 /* joins/retrieves an integer parameter with the FLEP_VAR or FLEP_CONST in
@@ -69,6 +82,16 @@ define FLEP_UNBALANCED
 #define FLEP_OPCODE(a) (a & 0xff)
 #define FLEP_OPPARM(a) ((a)>>8)
 
+#define FLEP_NAN (HUGE_VAL - HUGE_VAL) /* for expressions misused */
+
+/* Set all results of "f" over "n" rows to NaN, when it cannot be run
+ * (misused, or out of memory for its frame)
+ */
+#define FLEP_FILL_NAN(T, f, n, out) { \
+  size_t i_, n_ = (n) * (size_t)((f)->nout ? (f)->nout : 1); \
+  for (i_ = 0; i_ < n_; i_++) (out)[i_] = (T)FLEP_NAN; \
+}
+
 /* matching 'enum' FLEP_* defines */
 const char* dbg_strings[] = {
   "FLEP_OK",
@@ -94,19 +117,87 @@ const char* dbg_strings[] = {
   "FLEP_BADSYNTAX",
   "FLEP_BADTOKEN",
   "FLEP_EXPECTED_OPEN",
-  "FLEP_UNBALANCED"};
+  "FLEP_UNBALANCED",
+  "FLEP_STORE",
+  "FLEP_LOAD",
+  "FLEP_SINCOS",
+  "FLEP_NOMEMORY",
+  "FLEP_OUTPUT"};
 
 const char* flep_translate(int c) {
   return dbg_strings[c];
 }
 
-/* Stores RPN representation of parenthesized expression */
-struct FLEP {
+/* Instructions run by "flep_eval", translated from the opcodes in "text".
+ * The value at the top of the stack is held in an accumulator, the others
+ * in frame slots whose indices are known at compile time: instructions
+ * name the slot "d" where a push spills the accumulator, and the slot,
+ * variable or constant indices of their operands in "a" and "b".
+ * Besides one instruction per opcode, there are superinstructions fusing a
+ * binary operation with the variables ("V") and constants ("C") it takes as
+ * operands, e.g. "PLUS_VV" is VAR-VAR-PLUS, "DIV_CV" is CONST-VAR-DIV and
+ * "MULT_RC" (the accumulator by a constant) is CONST-MULT. "MULTPLUS_RC"
+ * is CONST-MULT-PLUS. Temporaries are kept in the frame after the slots.
+ */
+#define FLEP_FUSED_INSNS(X, OP) \
+  X(OP##_RV) X(OP##_RC) X(OP##_VV) X(OP##_VC) X(OP##_CV)
+#define FLEP_INSNS(X) \
+  X(END) X(UNARY_MINUS) X(PLUS) X(MINUS) X(MULT) X(DIV) X(POWER) \
+  X(VAR) X(CONST) X(SIN) X(COS) X(TAN) X(EXP) X(LOG) X(ABS) X(SQRT) \
+  FLEP_FUSED_INSNS(X, PLUS) FLEP_FUSED_INSNS(X, MINUS) \
+  FLEP_FUSED_INSNS(X, MULT) FLEP_FUSED_INSNS(X, DIV) \
+  FLEP_FUSED_INSNS(X, POWER) X(MULTPLUS_RC) \
+  X(STORE) X(LOAD) X(SINCOS) X(COSSIN) X(OUTPUT)
+#define FLEP_INSN_ENUM(n) FLEP_I_##n,
+#define FLEP_INSN_NAME(n) #n,
+enum { FLEP_INSNS(FLEP_INSN_ENUM) FLEP_N_INSNS };
+static const char* flep_insn_names[] = { FLEP_INSNS(FLEP_INSN_NAME) 0 };
+
+struct FLEPInsn {
+  int op; /* FLEP_I_* */
+  int d, a, b; /* spill slot, operands */
+};
+
+/* Stores RPN representation of parenthesized expression while compiling */
+struct FLEPBuild {
   double *data; /* numerical constants */
   int *text; /* opcodes */
   int sd, st; /* allocated size of the above */
   int nd, nt; /* number of used elements in the above */
+  struct FLEPInsn *code; /* "text" translated for "flep_eval" */
+  int nc; /* number of instructions in the above */
+  int depth; /* number of stack slots needed to run "text" */
+  int ntemp; /* number of temporaries used by "text" */
+  int nout; /* number of outputs, 0 for a single expression */
+  int flags; /* as given to "flep_parse_flags" */
+};
+
+/* Compiled expression: this header and then, in the same block, "nd"
+ * constants, "nc" instructions and "nt" opcodes. Holding no pointers, the
+ * block can be copied, written to a file and used wherever it is loaded
+ * (see "flep_serialize"), as long as it is aligned to 8 bytes.
+ */
+#define FLEP_MAGIC "FLEP"
+#define FLEP_VERSION 3 /* of the layout of the block and the opcodes */
+#define FLEP_ORDER 0x01020304 /* tells the byte order of the block */
+struct FLEP {
+  char magic[4]; /* FLEP_MAGIC */
+  int version; /* FLEP_VERSION */
+  int order; /* FLEP_ORDER */
+  int size; /* of the block in bytes, a multiple of 8 */
+  int heap; /* whether the block is to be freed by "flep_free" */
+  int nd, nc, nt;
+  int depth, ntemp, nout;
+  int flags; /* given to "flep_parse_flags" */
+  int vars; /* bit "i" set if variable "i" is used */
+  int stride; /* bytes per record if bound by "flep_bind", else 0 */
 };
+#define FLEP_DATA(f) ((const double*)((f) + 1))
+#define FLEP_CODE(f) ((const struct FLEPInsn*)(FLEP_DATA(f) + (f)->nd))
+#define FLEP_TEXT(f) ((const int*)(FLEP_CODE(f) + (f)->nc))
+#define FLEP_SIZE(nd, nc, nt) ((int)(sizeof(struct FLEP) + \
+  (nd) * sizeof(double) + (nc) * sizeof(struct FLEPInsn) + \
+  ((nt) * sizeof(int) + 7) / 8 * 8))
 
 /* token stream "object" */
 struct FLEPTokens {
@@ -116,68 +207,198 @@ struct FLEPTokens {
   int curr, last; /* 'enum' FLEP_* */
 };
 
+/* Class of each character, for the scanner: the token of symbols, FLEP_END
+ * for the terminating null, FLEP_VAR for letters (which make names),
+ * FLEP_CONST for digits (which start numbers), FLEP_START for blanks and
+ * FLEP_BADTOKEN for anything else. Unlike <ctype.h>, it does not depend
+ * on the locale.
+ */
+#define FLEP_XX FLEP_BADTOKEN
+#define FLEP_SP FLEP_START
+#define FLEP_AZ FLEP_VAR
+#define FLEP_09 FLEP_CONST
+#define FLEP_XX16 FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX, \
+  FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX, \
+  FLEP_XX, FLEP_XX
+static const unsigned char flep_chars[256] = {
+  /* 0x00 */ FLEP_END, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX,
+  FLEP_XX, FLEP_XX, FLEP_XX, FLEP_SP, FLEP_SP, FLEP_SP, FLEP_SP, FLEP_SP,
+  FLEP_XX, FLEP_XX,
+  /* 0x10 */ FLEP_XX16,
+  /* 0x20 */ FLEP_SP, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX,
+  FLEP_XX, FLEP_OPEN, FLEP_CLOSE, FLEP_MULT, FLEP_PLUS, FLEP_XX, FLEP_MINUS,
+  FLEP_XX, FLEP_DIV,
+  /* 0x30 */ FLEP_09, FLEP_09, FLEP_09, FLEP_09, FLEP_09, FLEP_09, FLEP_09,
+  FLEP_09, FLEP_09, FLEP_09, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX,
+  FLEP_XX,
+  /* 0x40 */ FLEP_XX, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ,
+  FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ,
+  FLEP_AZ,
+  /* 0x50 */ FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ,
+  FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_POWER,
+  FLEP_XX,
+  /* 0x60 */ FLEP_XX, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ,
+  FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ,
+  FLEP_AZ,
+  /* 0x70 */ FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ,
+  FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_AZ, FLEP_XX, FLEP_XX, FLEP_XX, FLEP_XX,
+  FLEP_XX,
+  /* 0x80 */ FLEP_XX16, FLEP_XX16, FLEP_XX16, FLEP_XX16,
+  FLEP_XX16, FLEP_XX16, FLEP_XX16, FLEP_XX16
+};
+#undef FLEP_XX
+#undef FLEP_SP
+#undef FLEP_AZ
+#undef FLEP_09
+#undef FLEP_XX16
+#define FLEP_CHAR(c) (flep_chars[(unsigned char)(c)])
+
+/* names of three letters packed into an int, to switch on them */
+#define FLEP_NAME3(x, y, z) ((x) << 16 | (y) << 8 | (z))
+
+/* value of "d" hex digit, -1 if it is not one */
+static int flep_hexdigit(int d) {
+  if (d >= '0' && d <= '9') return d - '0';
+  if (d >= 'a' && d <= 'f') return d - 'a' + 10;
+  if (d >= 'A' && d <= 'F') return d - 'A' + 10;
+  return -1;
+}
+
+/* Number at "s", setting "*end" past it: digits, optionally with a point
+ * and more digits, optionally with an exponent, e.g. "1", "2.", "3.5e-7"
+ * (or hexadecimal, e.g. "0x1.8p3", as "strtod" has always read them).
+ * Up to 15 significant digits and powers of ten up to 22 give a product
+ * or quotient of exact doubles, so rounded correctly (Clinger's fast
+ * path). Others go to "strtod", written with no point (whose character
+ * depends on the locale): "3.5e-7" as "35e-8". Hexadecimal digits are a
+ * power of two away from the value, exact if at most 13 of them.
+ */
+static double flep_number(const char* s, const char** end) {
+  static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+    1e20, 1e21, 1e22};
+  const char *p = s, *digits;
+  char buf[64], *q = buf;
+  double m = 0, limit = 900719925474098.0, value; /* m * 10 + 9 <= 2^53 */
+  int hex = 0, base = 10, d, nint, nfrac = 0, exact = 1, e = 0, sign = 1;
+  if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X') &&
+      (flep_hexdigit(p[2]) >= 0 ||
+      (p[2] == '.' && flep_hexdigit(p[3]) >= 0))) {
+    hex = 1;
+    base = 16;
+    limit = 562949953421311.0; /* m * 16 + 15 <= 2^53 */
+    p += 2;
+  }
+  digits = p;
+  for (; (d = hex ? flep_hexdigit(*p) : *p - '0') >= 0 && d < base; p++) {
+    if (m > limit) exact = 0;
+    m = m * base + d;
+  }
+  nint = p - digits;
+  if (*p == '.') {
+    for (p++; (d = hex ? flep_hexdigit(*p) : *p - '0') >= 0 && d < base;
+      p++, nfrac++) {
+      if (m > limit) exact = 0;
+      m = m * base + d;
+    }
+  }
+  if ((*p == (hex ? 'p' : 'e') || *p == (hex ? 'P' : 'E')) &&
+      (FLEP_CHAR(p[1]) == FLEP_CONST || ((p[1] == '+' || p[1] == '-') &&
+      FLEP_CHAR(p[2]) == FLEP_CONST))) {
+    p++;
+    if (*p == '+' || *p == '-') sign = (*p++ == '-') ? -1 : 1;
+    for (; FLEP_CHAR(*p) == FLEP_CONST; p++) {
+      if (e < 100000) e = e * 10 + (*p - '0'); /* beyond any double */
+    }
+    e *= sign;
+  }
+  *end = p;
+  if (!hex) {
+    e -= nfrac;
+    if (exact && m == 0) return 0;
+    if (exact && e >= 0 && e <= 22) return m * pow10[e];
+    if (exact && e < 0 && e >= -22) return m / pow10[-e];
+    if (exact && e > 22 && e <= 22 + 15 && m * pow10[e - 22] <=
+	9007199254740992.0) {
+      return (m * pow10[e - 22]) * pow10[22]; /* first product exact */
+    }
+  } else {
+    e -= 4 * nfrac;
+    if (exact) return ldexp(m, e); /* one rounding, if any */
+  }
+  /* "0x", all digits without the point, exponent, null */
+  if (nint + nfrac + 16 > (int)sizeof(buf)) {
+    q = (char*)malloc(nint + nfrac + 16);
+  }
+  d = 0;
+  if (hex) {
+    q[d++] = '0';
+    q[d++] = 'x';
+  }
+  memcpy(q + d, digits, nint);
+  d += nint;
+  if (nfrac) memcpy(q + d, digits + nint + 1, nfrac);
+  d += nfrac;
+  sprintf(q + d, "%c%d", hex ? 'p' : 'e', e);
+  value = strtod(q, 0);
+  if (q != buf) free(q);
+  return value;
+}
+
 /* advance token stream */
 static int flep_next(struct FLEPTokens *tok) {
+  const char* p = tok->q;
+  int c;
   tok->last = tok->curr;
-  tok->p = tok->q;
-  while (isspace((int)*tok->p)) tok->p++;
-  tok->curr = FLEP_BADTOKEN;
-  if (!*tok->p) {
-    tok->curr = FLEP_END;
-  } else if (isalpha((int)*tok->p)) {
-    tok->q = tok->p + 1;
-    while(isalpha((int)*tok->q)) tok->q++;
-    if (tok->q - tok->p == 1) {
-      if (*tok->p == 'e') {
-	tok->curr = FLEP_CONST;
-	tok->fval = exp(1);
-      } else {
-	static const char vars[] = "abcxyzw";
-	int i = strchr(vars, *tok->p) - vars;
-	if (i >= 0) {
-	  tok->curr = FLEP_VAR;
-	  tok->ival = i;
-	}
-      }
-    } else if (tok->q - tok->p == 2) {
-      if (!strncmp(tok->p, "pi", 2)) {
-	tok->curr = FLEP_CONST;
-	tok->fval = M_PI;
-      }
-    } else if (tok->q - tok->p == 3) {
-      /* Order is critical - search for "FLEPCodeDep" to see related data */
-      static const char* built_in[] = {
-	"sin", "cos", "tan", "exp", "log", "abs"}; 
-      static int n_built_in = sizeof(built_in) / sizeof(char*);
-      int i;
-      for (i = 0; i < n_built_in; i++) {
-	if (!strncmp(tok->p, built_in[i], 3)) {
-	  tok->curr = FLEP_SIN + i;
+  while ((c = FLEP_CHAR(*p)) == FLEP_START) p++;
+  tok->p = p;
+  tok->q = p + 1;
+  switch (c) {
+    case FLEP_VAR:
+      while (FLEP_CHAR(*tok->q) == FLEP_VAR) tok->q++;
+      c = FLEP_BADTOKEN;
+      switch (tok->q - p) {
+	case 1:
+	  switch (*p) {
+	    case 'a': c = FLEP_VAR; tok->ival = 0; break;
+	    case 'b': c = FLEP_VAR; tok->ival = 1; break;
+	    case 'c': c = FLEP_VAR; tok->ival = 2; break;
+	    case 'x': c = FLEP_VAR; tok->ival = 3; break;
+	    case 'y': c = FLEP_VAR; tok->ival = 4; break;
+	    case 'z': c = FLEP_VAR; tok->ival = 5; break;
+	    case 'w': c = FLEP_VAR; tok->ival = 6; break;
+	    case 'e': c = FLEP_CONST; tok->fval = exp(1); break;
+	  }
+	  break;
+	case 2:
+	  if (p[0] == 'p' && p[1] == 'i') {
+	    c = FLEP_CONST;
+	    tok->fval = M_PI;
+	  }
+	  break;
+	case 3:
+	  switch (FLEP_NAME3(p[0], p[1], p[2])) {
+	    case FLEP_NAME3('s', 'i', 'n'): c = FLEP_SIN; break;
+	    case FLEP_NAME3('c', 'o', 's'): c = FLEP_COS; break;
+	    case FLEP_NAME3('t', 'a', 'n'): c = FLEP_TAN; break;
+	    case FLEP_NAME3('e', 'x', 'p'): c = FLEP_EXP; break;
+	    case FLEP_NAME3('l', 'o', 'g'): c = FLEP_LOG; break;
+	    case FLEP_NAME3('a', 'b', 's'): c = FLEP_ABS; break;
+	  }
+	  break;
+	case 4:
+	  if (!memcmp(p, "sqrt", 4)) c = FLEP_SQRT;
 	  break;
-	}
-      }
-    } else if (tok->q - tok->p == 4) {
-      if (!strncmp(tok->p, "sqrt", 4)) {
-	tok->curr = FLEP_SQRT;
       }
-    }
-  } else if (isdigit((int)*tok->p)) {
-    char *ftail = 0;
-    tok->fval = (double)strtod(tok->p, &ftail);
-    if (ftail) {
-      tok->curr = FLEP_CONST;
-      tok->q = ftail;
-    }
-  } else {
-    /* Order is critical - search for "FLEPCodeDep" to see related data */
-    static const char sym[] = "()+-*/^";
-    int i = strchr(sym, *tok->p) - sym;
-    if (i >= 0) {
-      tok->curr = (int)(FLEP_OPEN) + i;
-      tok->q = tok->p + 1;
-    }
+      break;
+    case FLEP_CONST:
+      tok->fval = flep_number(p, &tok->q);
+      break;
+    case FLEP_END:
+      tok->q = p;
+      break;
   }
-  return tok->curr;
+  return tok->curr = c;
 }
   
 /* initialize token stream */
@@ -191,31 +412,33 @@ static int flep_tokenize(struct FLEPTokens* t, const char* s) {
  * consisting of literals, variables or parenthesized expressions, these
  * last consisting of sums of...
  */
-static int flep_get_sum(struct FLEPTokens* tok, struct FLEP* out);
-static int flep_get_prod(struct FLEPTokens* tok, struct FLEP* out);
-static int flep_get_power(struct FLEPTokens* tok, struct FLEP* out);
+static int flep_get_sum(struct FLEPTokens* tok, struct FLEPBuild* out);
+static int flep_get_prod(struct FLEPTokens* tok, struct FLEPBuild* out);
+static int flep_get_power(struct FLEPTokens* tok, struct FLEPBuild* out);
 
-void flep_accomodate_text(struct FLEP *out, int n) {
+void flep_accomodate_text(struct FLEPBuild *out, int n) {
+  if (out->text && out->st >= n) return;
   while(out->st < n) out->st *= 2;
-  out->text = (int*)realloc(out->text, out->st * sizeof(double));
+  out->text = (int*)realloc(out->text, out->st * sizeof(int));
 }
 
-void flep_accomodate_data(struct FLEP *out, int n) {
+void flep_accomodate_data(struct FLEPBuild *out, int n) {
+  if (out->data && out->sd >= n) return;
   while(out->sd < n) out->sd *= 2;
   out->data = (double*)realloc(out->data, out->sd * sizeof(double));
 }
 
-void flep_add_opcode(struct FLEP *out, int op) {
+void flep_add_opcode(struct FLEPBuild *out, int op) {
     flep_accomodate_text(out, out->nt+1);
     out->text[out->nt++] = op;
 }
 
-void flep_add_data(struct FLEP *out, double val) {
+void flep_add_data(struct FLEPBuild *out, double val) {
     flep_accomodate_data(out, out->nd+1);
     out->data[out->nd++] = val;
 }
 
-static int flep_get_operand(struct FLEPTokens* tok, struct FLEP* out) {
+static int flep_get_operand(struct FLEPTokens* tok, struct FLEPBuild* out) {
   int ret = FLEP_BADSYNTAX;
   if (tok->curr == FLEP_OPEN) {
     flep_next(tok);
@@ -239,10 +462,10 @@ static int flep_get_operand(struct FLEPTokens* tok, struct FLEP* out) {
       flep_next(tok);
       ret = flep_get_power(tok, out);
       flep_add_opcode(out, FLEP_UNARY_MINUS);
-    } else {
+    } else { /* after another sign, e.g. "--a" */
       flep_next(tok);
       ret = flep_get_operand(tok, out);
-      flep_add_opcode(out, FLEP_MINUS);
+      flep_add_opcode(out, FLEP_UNARY_MINUS);
     }
   } else if (tok->curr >= FLEP_SIN && tok->curr <= FLEP_SQRT) {
     /* Order is critical - search for "FLEPCodeDep" to see related data */
@@ -262,7 +485,7 @@ static int flep_get_operand(struct FLEPTokens* tok, struct FLEP* out) {
   return ret;
 }
 
-static int flep_get_power(struct FLEPTokens* tok, struct FLEP* out) {
+static int flep_get_power(struct FLEPTokens* tok, struct FLEPBuild* out) {
   int ret = flep_get_operand(tok, out);
   while (ret == FLEP_POWER) {
     flep_next(tok);
@@ -272,7 +495,7 @@ static int flep_get_power(struct FLEPTokens* tok, struct FLEP* out) {
   return ret;
 }
 
-static int flep_get_prod(struct FLEPTokens* tok, struct FLEP* out) {
+static int flep_get_prod(struct FLEPTokens* tok, struct FLEPBuild* out) {
   int ret = flep_get_power(tok, out);
   while (ret == FLEP_MULT || ret == FLEP_DIV) {
     int op = ret;
@@ -283,7 +506,7 @@ static int flep_get_prod(struct FLEPTokens* tok, struct FLEP* out) {
   return ret;
 }
 
-static int flep_get_sum(struct FLEPTokens* tok, struct FLEP* out) {
+static int flep_get_sum(struct FLEPTokens* tok, struct FLEPBuild* out) {
   int ret = flep_get_prod(tok, out);
   while (ret == FLEP_PLUS || ret == FLEP_MINUS) {
     int op = ret;
@@ -298,157 +521,2794 @@ static int flep_get_sum(struct FLEPTokens* tok, struct FLEP* out) {
   }
   return ret;
 }
-/* helper for "flep_optimize" */
-static void flep_delete_text(struct FLEP* out, int i, int n) {
-  int j;
-  for (j = i+n; j < out->nt; j++) {
-    out->text[j-n] = out->text[j];
+/* Common subexpression elimination: "text" is rebuilt as a DAG in which
+ * equal subexpressions are the same node (hash-consing), then emitted
+ * again with each node computed once. The first time a node with several
+ * uses is computed it is copied into a temporary (FLEP_STORE), afterwards
+ * it is pushed from there (FLEP_LOAD). sin(u) and cos(u) of the same u are
+ * computed together by FLEP_SINCOS, which leaves one on the stack and puts
+ * the other in a temporary.
+ * Nodes are created after their operands, so node indices are in
+ * topological order. This is also where constants are folded (see
+ * "flep_make"), all in time linear in the length of "text".
+ */
+struct FLEPNode {
+  int op, parm; /* opcode, and variable index of FLEP_VAR */
+  double val; /* value of FLEP_CONST */
+  int a, b; /* operand nodes, -1 if none */
+  int next; /* next node in the same hash bucket */
+  int uses; /* references from nodes reachable from the root */
+  int temp; /* temporary or data index it was emitted to, -1 if not yet */
+};
+
+struct FLEPDag {
+  struct FLEPNode* node;
+  int n, size; /* used and allocated nodes */
+  int* bucket; /* heads of hash chains, "size" of them */
+  int flags; /* FLEP_FASTMATH etc, see "flep_parse_flags" */
+};
+
+static unsigned long flep_hash(int op, int parm, double val, int a, int b) {
+  unsigned char bytes[sizeof(double)];
+  unsigned long h = (unsigned long)op * 31 + (unsigned long)parm;
+  unsigned i;
+  if (op == FLEP_CONST) { /* "val" is 0 for any other node */
+    memcpy(bytes, &val, sizeof(val));
+    for (i = 0; i < sizeof(bytes); i++) h = h * 131 + bytes[i];
   }
-  out->nt -= n;
+  h = h * 1000003UL + (unsigned long)a;
+  h = h * 1000003UL + (unsigned long)b;
+  return h ^ (h >> 15);
 }
 
-/* Very basic compiled-expression optimization */
-static void flep_optimize(struct FLEP* out) {
+/* index of node (op, parm, val, a, b), -1 if there is none and !create */
+static int flep_node(struct FLEPDag* g, int op, int parm, double val,
+  int a, int b, int create) {
+  unsigned long h = flep_hash(op, parm, val, a, b);
+  struct FLEPNode* nd;
   int i;
-  for (i = out->nt-2; i >= 0; i--) {
-    if (out->text[i] == FLEP_UNARY_MINUS &&
-	out->text[i-1] == FLEP_UNARY_MINUS) {
-      flep_delete_text(out, i-1, 2); /* remove 2 successive sign changes */
-      i--; continue;
-    }
-    if (FLEP_OPCODE(out->text[i]) == FLEP_CONST && i < out->nt-1) {
-      /* (maybe) resolve unary operations on constants */
-      int maybe_found_unary = 1;
-      int dpx = FLEP_OPPARM(out->text[i]);
-      double x = out->data[dpx];
-      switch (out->text[i+1]) { 
-	case FLEP_UNARY_MINUS: x = -x; break;
-	case FLEP_SIN: x = sin(x); break;
-	case FLEP_COS: x = cos(x); break;
-	case FLEP_TAN: x = tan(x); break;
-	case FLEP_EXP: x = exp(x); break;
-	case FLEP_LOG: x = log(x); break;
-	case FLEP_ABS: x = fabs(x); break;
-	case FLEP_SQRT: x = sqrt(x); break;
-	default: maybe_found_unary = 0;
+  for (i = g->bucket[h & (g->size - 1)]; i >= 0; i = g->node[i].next) {
+    nd = g->node + i;
+    if (nd->op == op && nd->parm == parm && nd->a == a && nd->b == b &&
+        !memcmp(&nd->val, &val, sizeof(val))) return i;
+  }
+  if (!create) return -1;
+  if (g->n == g->size) {
+    /* double the nodes and the buckets, then rehash */
+    g->size *= 2;
+    g->node = (struct FLEPNode*)realloc(g->node,
+      g->size * sizeof(struct FLEPNode));
+    g->bucket = (int*)realloc(g->bucket, g->size * sizeof(int));
+    for (i = 0; i < g->size; i++) g->bucket[i] = -1;
+    for (i = 0; i < g->n; i++) {
+      nd = g->node + i;
+      nd->next = g->bucket[flep_hash(nd->op, nd->parm, nd->val, nd->a,
+	nd->b) & (g->size - 1)];
+      g->bucket[flep_hash(nd->op, nd->parm, nd->val, nd->a, nd->b)
+	& (g->size - 1)] = i;
+    }
+  }
+  nd = g->node + g->n;
+  nd->op = op; nd->parm = parm; nd->val = val; nd->a = a; nd->b = b;
+  nd->uses = 0;
+  nd->temp = -1;
+  nd->next = g->bucket[h & (g->size - 1)];
+  g->bucket[h & (g->size - 1)] = g->n;
+  return g->n++;
+}
+
+/* Algebraic rewrites, done as nodes are made. Those giving the correctly
+ * rounded result of what they replace are always done: folding constants,
+ * x-c as x+(-c), x*1, x/1, x^0, x^1, x^2 as x*x, x^-1 as 1/x, division by
+ * a power of two as multiplication by its reciprocal and moving sign
+ * changes out of products (where pairs of them cancel) or into their
+ * constants. The others need FLEP_FASTMATH: any division by a constant,
+ * x^0.5 as sqrt(x), small integer powers as chains of multiplications,
+ * e^x as exp(x), x+0, and moving constants out of sums and products so
+ * they fold, e.g. "2*(2*a)" and "(2*a)*2" become "a*4".
+ * Constants are made the right operand of PLUS and MULT.
+ */
+#define FLEP_MAX_POWI 32 /* largest power turned into multiplications */
+#define FLEP_IS_CONST(g, i) ((i) >= 0 && (g)->node[i].op == FLEP_CONST)
+/* constant right operand of node "i", -1 if none */
+#define FLEP_CONST_B(g, i, o) ((g)->node[i].op == (o) && \
+  FLEP_IS_CONST(g, (g)->node[i].b) ? (g)->node[i].b : -1)
+
+static int flep_make(struct FLEPDag* g, int op, int a, int b);
+
+static int flep_const(struct FLEPDag* g, double val) {
+  return flep_node(g, FLEP_CONST, 0, val, -1, -1, 1);
+}
+
+/* value of "op" applied to constants */
+static double flep_fold(int op, double x, double y) {
+  switch (op) {
+    case FLEP_UNARY_MINUS: return -x;
+    case FLEP_PLUS: return x + y;
+    case FLEP_MINUS: return x - y;
+    case FLEP_MULT: return x * y;
+    case FLEP_DIV: return x / y;
+    case FLEP_POWER: return pow(x, y);
+    case FLEP_SIN: return sin(x);
+    case FLEP_COS: return cos(x);
+    case FLEP_TAN: return tan(x);
+    case FLEP_EXP: return exp(x);
+    case FLEP_LOG: return log(x);
+    case FLEP_ABS: return fabs(x);
+    default: return sqrt(x);
+  }
+}
+
+/* whether "x" is a power of two with an exact reciprocal */
+static int flep_pow2(double x) {
+  int e;
+  return fabs(frexp(x, &e)) == 0.5 && fabs(frexp(1 / x, &e)) == 0.5;
+}
+
+/* "x" to the "n"th (n > 0), by repeated squaring */
+static int flep_powi(struct FLEPDag* g, int x, int n) {
+  int h;
+  if (n == 1) return x;
+  h = flep_powi(g, x, n / 2);
+  h = flep_make(g, FLEP_MULT, h, h);
+  return (n & 1) ? flep_make(g, FLEP_MULT, h, x) : h;
+}
+
+/* node for "op" of "a" and "b" (-1 for unary operations), rewritten */
+static int flep_make(struct FLEPDag* g, int op, int a, int b) {
+  int fast = g->flags & FLEP_FASTMATH;
+  int ca = FLEP_IS_CONST(g, a), cb = FLEP_IS_CONST(g, b), k;
+  double x = g->node[a].val, y = cb ? g->node[b].val : 0;
+  int opa = g->node[a].op, opb = (b >= 0) ? g->node[b].op : 0;
+  if (ca && (b < 0 || cb)) return flep_const(g, flep_fold(op, x, y));
+  if ((op == FLEP_MULT || op == FLEP_DIV) &&
+      (opa == FLEP_UNARY_MINUS || opb == FLEP_UNARY_MINUS)) {
+    /* sign changes go out of products, or into their constants */
+    if (opa != FLEP_UNARY_MINUS) {
+      k = flep_make(g, op, a, g->node[b].a);
+    } else if (cb) {
+      return flep_make(g, op, g->node[a].a, flep_const(g, -y));
+    } else {
+      k = flep_make(g, op, g->node[a].a, b);
+    }
+    return flep_make(g, FLEP_UNARY_MINUS, k, -1);
+  }
+  switch (op) {
+    case FLEP_UNARY_MINUS:
+      if (opa == FLEP_UNARY_MINUS) return g->node[a].a;
+      if ((k = FLEP_CONST_B(g, a, FLEP_MULT)) >= 0 ||
+          (k = FLEP_CONST_B(g, a, FLEP_DIV)) >= 0) {
+	return flep_make(g, opa, g->node[a].a,
+	  flep_const(g, -g->node[k].val));
+      }
+      break;
+    case FLEP_PLUS:
+      if (ca) return flep_make(g, op, b, a);
+      if (cb && y == 0 && (fast || 1 / y < 0)) return a;
+      if (opb == FLEP_UNARY_MINUS)
+	return flep_make(g, FLEP_MINUS, a, g->node[b].a);
+      if (!fast) break;
+      if ((k = FLEP_CONST_B(g, a, FLEP_PLUS)) >= 0) {
+	/* (x+c)+y as (x+y)+c, folding if "y" is a constant */
+	return cb ? flep_make(g, op, g->node[a].a,
+	    flep_const(g, g->node[k].val + y)) :
+	  flep_make(g, op, flep_make(g, op, g->node[a].a, b), k);
+      }
+      if ((k = FLEP_CONST_B(g, b, FLEP_PLUS)) >= 0)
+	return flep_make(g, op, flep_make(g, op, a, g->node[b].a), k);
+      break;
+    case FLEP_MINUS:
+      if (cb) return flep_make(g, FLEP_PLUS, a, flep_const(g, -y));
+      if (opb == FLEP_UNARY_MINUS)
+	return flep_make(g, FLEP_PLUS, a, g->node[b].a);
+      if (!fast) break;
+      if ((k = FLEP_CONST_B(g, a, FLEP_PLUS)) >= 0)
+	return flep_make(g, FLEP_PLUS, flep_make(g, op, g->node[a].a, b), k);
+      if ((k = FLEP_CONST_B(g, b, FLEP_PLUS)) >= 0)
+	return flep_make(g, FLEP_PLUS, flep_make(g, op, a, g->node[b].a),
+	  flep_const(g, -g->node[k].val));
+      break;
+    case FLEP_MULT:
+      if (ca) return flep_make(g, op, b, a);
+      if (cb && y == 1) return a;
+      if (cb && y == -1) return flep_make(g, FLEP_UNARY_MINUS, a, -1);
+      if (!fast) break;
+      if ((k = FLEP_CONST_B(g, a, FLEP_MULT)) >= 0) {
+	return cb ? flep_make(g, op, g->node[a].a,
+	    flep_const(g, g->node[k].val * y)) :
+	  flep_make(g, op, flep_make(g, op, g->node[a].a, b), k);
+      }
+      if ((k = FLEP_CONST_B(g, b, FLEP_MULT)) >= 0)
+	return flep_make(g, op, flep_make(g, op, a, g->node[b].a), k);
+      break;
+    case FLEP_DIV:
+      if (cb && y == 1) return a;
+      if (cb && (fast || flep_pow2(y)))
+	return flep_make(g, FLEP_MULT, a, flep_const(g, 1 / y));
+      break;
+    case FLEP_POWER:
+      if (cb && y == 0) return flep_const(g, 1);
+      if (cb && y == 1) return a;
+      if (cb && y == 2) return flep_make(g, FLEP_MULT, a, a);
+      if (cb && y == -1) return flep_make(g, FLEP_DIV, flep_const(g, 1), a);
+      if (!fast) break;
+      if (cb && fabs(y) == 0.5) {
+	k = flep_make(g, FLEP_SQRT, a, -1);
+	return (y > 0) ? k : flep_make(g, FLEP_DIV, flep_const(g, 1), k);
+      }
+      if (cb && y == (int)y && fabs(y) <= FLEP_MAX_POWI) {
+	k = flep_powi(g, a, (int)fabs(y));
+	return (y > 0) ? k : flep_make(g, FLEP_DIV, flep_const(g, 1), k);
+      }
+      if (ca && x == exp(1)) return flep_make(g, FLEP_EXP, b, -1);
+      break;
+  }
+  return flep_node(g, op, 0, 0, a, b, 1);
+}
+
+/* build DAG from "text", setting the root node of each output in "roots"
+ * (just one without FLEP_OUTPUT), returns the number of roots */
+static int flep_dag(struct FLEPDag* g, const struct FLEPBuild* in,
+  int* roots) {
+  int *stack = (int*)malloc((in->nt + 1) * sizeof(int));
+  int *temp = (int*)malloc((in->nt + 1) * sizeof(int));
+  int i, sp = -1;
+  stack[0] = -1;
+  for (i = 0; i < in->nt; i++) {
+    int op = FLEP_OPCODE(in->text[i]), parm = FLEP_OPPARM(in->text[i]);
+    switch (op) {
+      case FLEP_END: break;
+      case FLEP_VAR:
+	stack[++sp] = flep_node(g, op, parm, 0, -1, -1, 1); break;
+      case FLEP_CONST:
+	stack[++sp] = flep_node(g, op, 0, in->data[parm], -1, -1, 1); break;
+      case FLEP_STORE: temp[parm] = stack[sp]; break;
+      case FLEP_LOAD: stack[++sp] = temp[parm]; break;
+      case FLEP_OUTPUT: roots[parm] = stack[sp--]; break;
+      case FLEP_SINCOS:
+	/* made by "flep_make", to fold them if "flep_specialize" made the
+	 * argument constant
+	 */
+	temp[parm >> 1] = flep_make(g, (parm & 1) ? FLEP_SIN : FLEP_COS,
+	  stack[sp], -1);
+	stack[sp] = flep_make(g, (parm & 1) ? FLEP_COS : FLEP_SIN, stack[sp],
+	  -1);
+	break;
+      case FLEP_PLUS: case FLEP_MINUS: case FLEP_MULT: case FLEP_DIV:
+      case FLEP_POWER:
+	sp--;
+	stack[sp] = flep_make(g, op, stack[sp], stack[sp+1]);
+	break;
+      default:
+	stack[sp] = flep_make(g, op, stack[sp], -1);
+    }
+  }
+  if (!in->nout) roots[0] = stack[0];
+  free(stack);
+  free(temp);
+  return in->nout ? in->nout : 1;
+}
+
+/* whether node "i" is a leaf, i.e. pushed by a single opcode */
+#define FLEP_LEAF(g, i) ((g)->node[i].op == FLEP_VAR || \
+  (g)->node[i].op == FLEP_CONST)
+
+/* emit "text" (and "data") of "out" from the DAG with "nroot" roots,
+ * each followed by its FLEP_OUTPUT if "out" has outputs
+ */
+static void flep_emit(struct FLEPDag* g, const int* roots, int nroot,
+  struct FLEPBuild* out) {
+  int *stack = (int*)malloc(2 * g->n * sizeof(int)), sp, i, k;
+  /* count uses from reachable nodes, going from parents to operands */
+  for (i = 0; i < g->n; i++) g->node[i].uses = 0;
+  for (k = 0; k < nroot; k++) g->node[roots[k]].uses++;
+  for (i = g->n - 1; i >= 0; i--) {
+    struct FLEPNode* nd = g->node + i;
+    if (!nd->uses) continue;
+    if (nd->a >= 0) g->node[nd->a].uses++;
+    if (nd->b >= 0) g->node[nd->b].uses++;
+  }
+  out->nt = out->nd = 0;
+  out->ntemp = 0;
+  /* postorder walk, "stack" holds pairs of node and operands visited */
+  for (k = 0; k < nroot; k++) {
+    sp = 0;
+    stack[0] = roots[k];
+    stack[1] = 0;
+    while (sp >= 0) {
+      int n = stack[2*sp], *state = stack + 2*sp + 1;
+      struct FLEPNode* nd = g->node + n;
+      int first = nd->a, second = nd->b;
+      if (*state == 0 && nd->temp >= 0 && !FLEP_LEAF(g, n)) {
+	flep_add_opcode(out, FLEP_BITFUSE(FLEP_LOAD, nd->temp));
+	sp--;
+	continue;
+      }
+      if ((nd->op == FLEP_PLUS || nd->op == FLEP_MULT) &&
+	  FLEP_LEAF(g, first) && !FLEP_LEAF(g, second)) {
+	/* commute, so the leaf can be fused with the operation */
+	first = nd->b;
+	second = nd->a;
+      }
+      if (*state == 0 && first >= 0) {
+	*state = 1;
+	stack[2*(++sp)] = first;
+	stack[2*sp + 1] = 0;
+	continue;
+      }
+      if (*state <= 1 && second >= 0) {
+	*state = 2;
+	stack[2*(++sp)] = second;
+	stack[2*sp + 1] = 0;
+	continue;
       }
-      if (maybe_found_unary) {
-	out->data[dpx] = x;
-	flep_delete_text(out, i+1, 1);
-	i++; continue;
+      sp--;
+      if (nd->op == FLEP_VAR) {
+	flep_add_opcode(out, FLEP_BITFUSE(FLEP_VAR, nd->parm));
+      } else if (nd->op == FLEP_CONST) {
+	if (nd->temp < 0) {
+	  flep_add_data(out, nd->val);
+	  nd->temp = out->nd - 1;
+	}
+	flep_add_opcode(out, FLEP_BITFUSE(FLEP_CONST, nd->temp));
       } else {
-	if (i && FLEP_OPCODE(out->text[i-1]) == FLEP_CONST) {
-	  /* (maybe) resolve binary operations on constants on constants */
-	  int maybe_found_binary = 1;
-	  int dpx = FLEP_OPPARM(out->text[i-1]);
-	  int dpy = FLEP_OPPARM(out->text[i]);
-	  double x = out->data[dpx], y = out->data[dpy];
-	  switch (out->text[i+1]) { 
-	    case FLEP_PLUS: x += y; break;
-	    case FLEP_MINUS: x -= y; break;
-	    case FLEP_MULT: x *= y; break;
-	    case FLEP_DIV: x /= y; break;
-	    case FLEP_POWER: x = pow(x,y); break;
-	    default:
-	      maybe_found_binary = 0; break;
-	  }
-	  if (maybe_found_binary) {
-	    out->data[dpx] = x;
-	    flep_delete_text(out, i, 2);
-	    if (FLEP_OPCODE(out->text[i]) == FLEP_CONST) {
-	      i++; /* removed operation was between two FLEP_CONST, revisit */
-	    }
-	    continue;
-	  }
+	int other = -1;
+	if (nd->op == FLEP_SIN || nd->op == FLEP_COS) {
+	  other = flep_node(g, FLEP_SIN + FLEP_COS - nd->op, 0, 0, nd->a, -1, 0);
+	}
+	if (other >= 0 && g->node[other].uses && g->node[other].temp < 0) {
+	  g->node[other].temp = out->ntemp++;
+	  flep_add_opcode(out, FLEP_BITFUSE(FLEP_SINCOS,
+	    g->node[other].temp << 1 | (nd->op == FLEP_COS)));
+	} else {
+	  flep_add_opcode(out, nd->op);
+	}
+	if (nd->uses > 1) {
+	  nd->temp = out->ntemp++;
+	  flep_add_opcode(out, FLEP_BITFUSE(FLEP_STORE, nd->temp));
 	}
       }
     }
+    if (out->nout) flep_add_opcode(out, FLEP_BITFUSE(FLEP_OUTPUT, k));
   }
+  free(stack);
 }
 
-/* callable functions: */
+/* rebuild "out" computing common subexpressions once */
+static void flep_cse(struct FLEPBuild* out, int flags) {
+  struct FLEPDag g;
+  int i, nroot, *roots = (int*)malloc((out->nout + 1) * sizeof(int));
+  g.flags = flags;
+  g.size = 16;
+  while (g.size < out->nt) g.size *= 2;
+  g.n = 0;
+  g.node = (struct FLEPNode*)malloc(g.size * sizeof(struct FLEPNode));
+  g.bucket = (int*)malloc(g.size * sizeof(int));
+  for (i = 0; i < g.size; i++) g.bucket[i] = -1;
+  nroot = flep_dag(&g, out, roots);
+  flep_emit(&g, roots, nroot, out);
+  free(roots);
+  free(g.node);
+  free(g.bucket);
+}
 
-const struct FLEP* flep_parse(const char* s, int *error, 
-  int* position) {
+/* number of stack slots needed to run "f" */
+static int flep_depth(const struct FLEPBuild* f) {
+  int ip, sp = 0, depth = 0;
+  for (ip = 0; f->text[ip] != FLEP_END; ip++) {
+    switch (FLEP_OPCODE(f->text[ip])) {
+      case FLEP_VAR: case FLEP_CONST: case FLEP_LOAD: sp++; break;
+      case FLEP_PLUS: case FLEP_MINUS: case FLEP_MULT: case FLEP_DIV:
+      case FLEP_POWER: case FLEP_OUTPUT: sp--; break;
+    }
+    if (sp > depth) depth = sp;
+  }
+  return depth;
+}
 
-  struct FLEPTokens tok;
-  int status;
-  struct FLEP* out = (struct FLEP*)malloc(sizeof(struct FLEP));
-  flep_tokenize(&tok, s);
+/* Translate "text" into instructions, fusing operands with operations.
+ * "sp" is the slot the top of the stack would have: pushes spill the
+ * accumulator to slot "sp" (slot 0, harmlessly, for the first push) and
+ * binary operations find their left operand in slot "sp-1".
+ */
+static void flep_thread(struct FLEPBuild* out) {
+  int i, n = 0, sp = -1;
+  out->code = (struct FLEPInsn*)malloc(out->nt * sizeof(struct FLEPInsn));
+  for (i = 0; i < out->nt; i++) {
+    struct FLEPInsn* c = out->code + n++;
+    int op = FLEP_OPCODE(out->text[i]), parm = FLEP_OPPARM(out->text[i]);
+    int leaf = (op == FLEP_VAR || op == FLEP_CONST);
+    int op1 = (i + 1 < out->nt) ? FLEP_OPCODE(out->text[i+1]) : FLEP_END;
+    int op2 = (i + 2 < out->nt) ? FLEP_OPCODE(out->text[i+2]) : FLEP_END;
+    c->d = c->a = c->b = 0;
+    if (leaf && (op1 == FLEP_VAR || op1 == FLEP_CONST) &&
+        op2 >= FLEP_PLUS && op2 <= FLEP_POWER &&
+        (op == FLEP_VAR || op1 == FLEP_VAR)) {
+      /* e.g. VAR-CONST-MULT, not CONST-CONST (which was optimized away) */
+      c->op = (op == FLEP_CONST) ? FLEP_I_PLUS_CV :
+        (op1 == FLEP_VAR) ? FLEP_I_PLUS_VV : FLEP_I_PLUS_VC;
+      c->d = (sp < 0) ? 0 : sp;
+      sp++;
+      c->a = parm;
+      c->b = FLEP_OPPARM(out->text[i+1]);
+      i += 2;
+    } else if (op == FLEP_CONST && op1 == FLEP_MULT && op2 == FLEP_PLUS) {
+      c->op = FLEP_I_MULTPLUS_RC;
+      c->a = --sp;
+      c->b = parm;
+      i += 2;
+      continue;
+    } else if (leaf && op1 >= FLEP_PLUS && op1 <= FLEP_POWER) {
+      c->op = (op == FLEP_VAR) ? FLEP_I_PLUS_RV : FLEP_I_PLUS_RC;
+      c->b = parm;
+      i += 1;
+      op2 = op1;
+    } else {
+      /* Order is critical - search for "FLEPCodeDep" to see related data */
+      static const int plain[] = {-1, FLEP_I_UNARY_MINUS, -1, -1,
+	FLEP_I_PLUS, FLEP_I_MINUS, FLEP_I_MULT, FLEP_I_DIV, FLEP_I_POWER,
+	FLEP_I_VAR, FLEP_I_CONST, FLEP_I_SIN, FLEP_I_COS, FLEP_I_TAN,
+	FLEP_I_EXP, FLEP_I_LOG, FLEP_I_ABS, FLEP_I_SQRT, -1, FLEP_I_END,
+	-1, -1, -1, -1, FLEP_I_STORE, FLEP_I_LOAD, FLEP_I_SINCOS, -1,
+	FLEP_I_OUTPUT};
+      c->op = plain[op];
+      if (leaf || op == FLEP_LOAD) {
+	c->d = (sp < 0) ? 0 : sp;
+	sp++;
+	c->a = (op == FLEP_LOAD) ? out->depth + parm : parm;
+      } else if (op >= FLEP_PLUS && op <= FLEP_POWER) {
+	c->a = --sp;
+      } else if (op == FLEP_STORE) {
+	c->a = out->depth + parm;
+      } else if (op == FLEP_OUTPUT) {
+	c->a = parm;
+	sp--;
+      } else if (op == FLEP_SINCOS) {
+	/* the one left in the accumulator comes first */
+	c->op = (parm & 1) ? FLEP_I_COSSIN : FLEP_I_SINCOS;
+	c->a = out->depth + (parm >> 1);
+      }
+      continue;
+    }
+    /* fused instructions of each kind follow the order PLUS ... POWER */
+    c->op += (op2 - FLEP_PLUS) * (FLEP_I_MINUS_RV - FLEP_I_PLUS_RV);
+  }
+  out->nc = n;
+}
+
+/* free what was allocated while compiling */
+static void flep_release(struct FLEPBuild* b) {
+  free(b->text);
+  free(b->data);
+  free(b->code);
+}
+
+/* copy what was compiled into "b" to block "f", "size" bytes long */
+static struct FLEP* flep_pack(const struct FLEPBuild* b, struct FLEP* f,
+  int size, int heap) {
+  int i;
+  memset(f, 0, size);
+  memcpy(f->magic, FLEP_MAGIC, 4);
+  f->version = FLEP_VERSION;
+  f->order = FLEP_ORDER;
+  f->size = size;
+  f->heap = heap;
+  f->nd = b->nd;
+  f->nc = b->nc;
+  f->nt = b->nt;
+  f->depth = b->depth;
+  f->ntemp = b->ntemp;
+  f->nout = b->nout;
+  f->flags = b->flags;
+  for (i = 0; i < b->nt; i++) {
+    if (FLEP_OPCODE(b->text[i]) == FLEP_VAR) {
+      f->vars |= 1 << FLEP_OPPARM(b->text[i]);
+    }
+  }
+  memcpy((double*)FLEP_DATA(f), b->data, b->nd * sizeof(double));
+  memcpy((struct FLEPInsn*)FLEP_CODE(f), b->code,
+    b->nc * sizeof(struct FLEPInsn));
+  memcpy((int*)FLEP_TEXT(f), b->text, b->nt * sizeof(int));
+  return f;
+}
+
+/* empty "out", for a program of "nout" outputs compiled with "flags" */
+static void flep_build_init(struct FLEPBuild* out, int nout, int flags) {
   out->text = 0;
   out->data = 0;
+  out->code = 0;
   out->st = out->sd = 8;
   flep_accomodate_text(out, 16);
   flep_accomodate_data(out, 16);
   out->nt = out->nd = 0;
-  status = flep_get_sum(&tok, out);
-  if (status == FLEP_END) {
-    flep_optimize(out);
-    flep_add_opcode(out, FLEP_END);
-    return out;
-  } else {
-    free(out);
+  out->nout = nout;
+  out->flags = flags;
+}
+
+/* rewrite the opcodes of "out" through the DAG, end them and thread them */
+static void flep_optimize(struct FLEPBuild* out) {
+  flep_cse(out, out->flags);
+  flep_add_opcode(out, FLEP_END);
+  out->depth = flep_depth(out);
+  flep_thread(out);
+}
+
+/* Compile the "n" expressions in "s" into "out", as outputs of a single
+ * program if "many", returning FLEP_OK or an error code. Unless FLEP_OK,
+ * "*position" and "*which" (the failed expression) are set if not null,
+ * and nothing needs freeing.
+ */
+static int flep_compile(struct FLEPBuild* out, const char** s, int n,
+  int many, int flags, int* position, int* which) {
+  struct FLEPTokens tok;
+  int i, status = FLEP_BADSYNTAX;
+  flep_build_init(out, many ? n : 0, flags);
+  for (i = 0; i < n; i++) {
+    flep_tokenize(&tok, s[i]);
+    status = flep_get_sum(&tok, out);
+    if (status != FLEP_END) break;
+    if (many) flep_add_opcode(out, FLEP_BITFUSE(FLEP_OUTPUT, i));
+  }
+  if (status != FLEP_END) {
+    flep_release(out);
+    if (position) *position = (i < n) ? tok.p - tok.src + 1 : 1;
+    if (which) *which = i;
+    return status;
+  }
+  flep_optimize(out);
+  return FLEP_OK;
+}
+
+/* block on the heap for "out", compiled with "status" */
+static const struct FLEP* flep_finish(struct FLEPBuild* out, int status,
+  int* error) {
+  struct FLEP* f;
+  int size;
+  if (status != FLEP_OK) {
     if (error) *error = status;
-    if (position) *position = tok.p - tok.src + 1;
     return 0;
   }
+  size = FLEP_SIZE(out->nd, out->nc, out->nt);
+  f = flep_pack(out, (struct FLEP*)malloc(size), size, 1);
+  flep_release(out);
+  return f;
 }
 
-/* no mysteries left - use stack to run compiled expression */
-double flep_eval(const struct FLEP* f, double* val) {
-  double stack[64];
-  int ip = 0, sp = -1;
-  for (;;ip++) {
-    double x = stack[sp];
-    int idx = FLEP_OPPARM(f->text[ip]);
-    switch (FLEP_OPCODE(f->text[ip])) {
-      case FLEP_UNARY_MINUS: stack[sp] = -x; continue;
-      case FLEP_PLUS: stack[--sp] += x; continue;
-      case FLEP_MINUS: stack[--sp] -= x; continue;
-      case FLEP_MULT: stack[--sp] *= x; continue;
-      case FLEP_DIV: stack[--sp] /= x; continue;
-      case FLEP_POWER: --sp; stack[sp] = pow(stack[sp], x); continue;
-      case FLEP_VAR: stack[++sp] = val[idx]; continue;
-      case FLEP_CONST: stack[++sp] = f->data[idx]; continue;
-      case FLEP_SIN: stack[sp] = sin(x); continue;
-      case FLEP_COS: stack[sp] = cos(x); continue;
-      case FLEP_TAN: stack[sp] = tan(x); continue;
-      case FLEP_EXP: stack[sp] = exp(x); continue;
-      case FLEP_LOG: stack[sp] = log(x); continue;
-      case FLEP_ABS: stack[sp] = fabs(x); continue;
-      case FLEP_SQRT: stack[sp] = sqrt(x); continue;
-      case FLEP_END: return stack[0];
-    }
-  }
-  return stack[0];
+/* callable functions: */
+
+const struct FLEP* flep_parse(const char* s, int *error, 
+  int* position) {
+  return flep_parse_flags(s, 0, error, position);
 }
 
-/* ... */
-void flep_free(const struct FLEP* f) {
-  if (f) {
-    free(f->text);
-    free(f->data);
-    free((void*)f);
-  }
+const struct FLEP* flep_parse_flags(const char* s, int flags, int *error,
+  int* position) {
+  struct FLEPBuild out;
+  return flep_finish(&out,
+    flep_compile(&out, &s, 1, 0, flags, position, 0), error);
 }
 
-/* published pretty printer for compiled expression */
-void flep_dump(const struct FLEP* f) {
+const struct FLEP* flep_parse_many(const char** exprs, int n, int flags,
+  int* error, int* position, int* which) {
+  struct FLEPBuild out;
+  return flep_finish(&out,
+    flep_compile(&out, exprs, n, 1, flags, position, which), error);
+}
+
+/* Recompile "f" from its opcodes, with the variables in "mask" turned into
+ * constants: the DAG folds everything depending only on them.
+ */
+const struct FLEP* flep_specialize(const struct FLEP* f, int mask,
+  const double* values) {
+  struct FLEPBuild out;
+  const int* text = FLEP_TEXT(f);
   int i;
-  printf("\n");
-  for (i = 0; i < f->nt; i++) {
-    int op = f->text[i];
-    switch(FLEP_OPCODE(op)) {
-      case FLEP_CONST:
-	printf("%d: %s (%12.6f)\n", i, dbg_strings[FLEP_CONST], 
-	  f->data[FLEP_OPPARM(op)]);
-	break;
-      case FLEP_VAR:
-	printf("%d: %s (%d)\n", i, dbg_strings[FLEP_VAR], FLEP_OPPARM(op));
-	break;
-      default:
-	printf("%d: %s\n", i, dbg_strings[op]);
+  if (f->stride) return 0;
+  flep_build_init(&out, f->nout, f->flags);
+  for (i = 0; i < f->nd; i++) flep_add_data(&out, FLEP_DATA(f)[i]);
+  for (i = 0; i < f->nt - 1; i++) { /* all but FLEP_END */
+    int op = text[i], v = FLEP_OPPARM(op);
+    if (FLEP_OPCODE(op) == FLEP_VAR && (mask >> v & 1)) {
+      op = FLEP_BITFUSE(FLEP_CONST, out.nd);
+      flep_add_data(&out, values[v]);
     }
+    flep_add_opcode(&out, op);
+  }
+  flep_optimize(&out);
+  return flep_finish(&out, FLEP_OK, 0);
+}
+
+const struct FLEP* flep_parse_arena(struct FLEPArena* arena, const char* s,
+  int flags, int *error, int* position) {
+  struct FLEPBuild out;
+  struct FLEP* f = 0;
+  size_t at = (arena->used + 7) / 8 * 8;
+  int status = flep_compile(&out, &s, 1, 0, flags, position, 0), size;
+  if (status != FLEP_OK) {
+    if (error) *error = status;
+    return 0;
+  }
+  size = FLEP_SIZE(out.nd, out.nc, out.nt);
+  if (at <= arena->size && arena->size - at >= (size_t)size) {
+    f = flep_pack(&out, (struct FLEP*)(arena->base + at), size, 0);
+    arena->used = at + size;
+  } else {
+    if (error) *error = FLEP_NOMEMORY;
+    if (position) *position = 1;
+  }
+  flep_release(&out);
+  return f;
+}
+
+/* sine and cosine of "x" at once, where the C library allows */
+static void flep_sincos(double x, double* s, double* c) {
+#ifdef __GLIBC__
+  sincos(x, s, c);
+#else
+  *s = sin(x);
+  *c = cos(x);
+#endif
+}
+
+/* Single precision math functions are C99; C89 libraries may only have
+ * those for doubles, whose results are then rounded
+ */
+#if defined(__GLIBC__) || \
+  (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
+#define FLEP_F(fn) fn##f
+#else
+#define FLEP_F(fn) (float)fn
+#endif
+
+static void flep_sincosf(float x, float* s, float* c) {
+#ifdef __GLIBC__
+  sincosf(x, s, c);
+#else
+  *s = FLEP_F(sin)(x);
+  *c = FLEP_F(cos)(x);
+#endif
+}
+
+/* Math functions for "flep_eval_batch" over blocks of "m" values: "unary"
+ * applies "op", FLEP_SIN to FLEP_LOG, to "x"; "pow" raises "y" to "x"; and
+ * "sincos" stores the sines and cosines of "x" (which may be either) to "s"
+ * and "c". Those of the C library are looped over lanes; FLEP's own (see
+ * below) are vectorized.
+ */
+struct FLEPMath {
+  void (*unary)(double* x, int m, int op);
+  void (*pow)(double* y, const double* x, int m);
+  void (*sincos)(const double* x, double* s, double* c, int m);
+};
+struct FLEPMathF {
+  void (*unary)(float* x, int m, int op);
+  void (*pow)(float* y, const float* x, int m);
+  void (*sincos)(const float* x, float* s, float* c, int m);
+};
+
+#define FLEP_C_MATH(pfx, T, S, m_sin, m_cos, m_tan, m_exp, m_log, m_pow, \
+  m_sincos) \
+static void pfx##unary(T* x, int m, int op) { \
+  int k; \
+  switch (op) { \
+    case FLEP_SIN: for (k = 0; k < m; k++) x[k] = m_sin(x[k]); break; \
+    case FLEP_COS: for (k = 0; k < m; k++) x[k] = m_cos(x[k]); break; \
+    case FLEP_TAN: for (k = 0; k < m; k++) x[k] = m_tan(x[k]); break; \
+    case FLEP_EXP: for (k = 0; k < m; k++) x[k] = m_exp(x[k]); break; \
+    case FLEP_LOG: for (k = 0; k < m; k++) x[k] = m_log(x[k]); break; \
+  } \
+} \
+static void pfx##pow(T* y, const T* x, int m) { \
+  int k; \
+  for (k = 0; k < m; k++) y[k] = m_pow(y[k], x[k]); \
+} \
+static void pfx##sincos(const T* x, T* s, T* c, int m) { \
+  int k; \
+  for (k = 0; k < m; k++) m_sincos(x[k], s + k, c + k); \
+} \
+static const struct S pfx##math = {pfx##unary, pfx##pow, pfx##sincos};
+FLEP_C_MATH(flep_libm_, double, FLEPMath, sin, cos, tan, exp, log, pow,
+  flep_sincos)
+FLEP_C_MATH(flep_libmf_, float, FLEPMathF, FLEP_F(sin), FLEP_F(cos),
+  FLEP_F(tan), FLEP_F(exp), FLEP_F(log), FLEP_F(pow), flep_sincosf)
+
+/* FLEP's own math functions, used instead of the C library's for
+ * expressions parsed with FLEP_APPROX. Each reduces its argument (by
+ * multiples of ln 2 or pi/2, or to a mantissa) and sums a Taylor series
+ * over a few powers at once (Estrin's scheme), keeping chains of dependent
+ * operations short. The series are macros, expanded for scalars in plain C
+ * and for GCC vector types, over which exponents are taken apart and put
+ * together as bits; on x86-64 the scalar functions are lanes of the SSE2
+ * vector ones, so all widths give the same results.
+ * Trigonometric functions beyond FLEP_TRIG_MAX, and powers x^y with x not
+ * positive or |y log x| beyond FLEP_POW_MAX, are left to the C library.
+ */
+#define FLEP_ROUND 6755399441055744.0 /* 1.5 * 2^52: adding it rounds */
+#define FLEP_INV_LN2 1.44269504088896338700
+#define FLEP_LN2_HI 6.93147180369123816490e-01 /* ln 2 in two parts, the */
+#define FLEP_LN2_LO 1.90821492927058770002e-10 /* first exact times ints */
+#define FLEP_SQRT2 1.41421356237309504880
+#define FLEP_2_PI 6.36619772367581382433e-01
+#define FLEP_PI_2_1 1.57079632673412561417 /* pi/2 in three parts, the */
+#define FLEP_PI_2_2 6.07710050630396597660e-11 /* first two exact times */
+#define FLEP_PI_2_3 2.02226624879595063154e-21 /* ints up to 2^20, the */
+/* last the full 53 bits of the rest, for results near zeros of sin, cos */
+#define FLEP_TRIG_MAX 1e5
+#define FLEP_POW_MAX 16.0
+#define FLEP_SPLIT 134217729.0 /* 2^27 + 1, splits doubles in halves */
+
+/* e^r for |r| <= ln(2)/2, given r^2 and r^4 */
+#define FLEP_EXP_POLY(r, r2, r4) (1 + (r + (r2 * (1/2. + r * (1/6.)) \
+  + (r4 * ((1/24. + r * (1/120.)) + r2 * (1/720. + r * (1/5040.))) \
+  + r4 * r4 * ((1/40320. + r * (1/362880.)) \
+    + r2 * (1/3628800. + r * (1/39916800.)) \
+    + r4 * (1/479001600. + r * (1/6227020800.)))))))
+/* (log((1+s)/(1-s)) - 2s) / s for |s| < 0.172, given w = s^2 and powers */
+#define FLEP_LOG_POLY(w, w2, w4) (w * ((2/3. + w * (2/5.)) \
+  + w2 * (2/7. + w * (2/9.)) + w4 * ((2/11. + w * (2/13.)) \
+  + w2 * (2/15. + w * (2/17.)) + w4 * (2/19. + w * (2/21.)))))
+/* sin r and cos r for |r| <= pi/4, given z = r^2 and powers */
+#define FLEP_SIN_POLY(r, z, z2, z4) (r + r * z * ((-1/6. + z * (1/120.)) \
+  + z2 * (-1/5040. + z * (1/362880.)) \
+  + z4 * ((-1/39916800. + z * (1/6227020800.)) \
+    + z2 * (-1/1307674368000. + z * (1/355687428096000.)))))
+#define FLEP_COS_POLY(z, z2, z4) (1 - 0.5 * z \
+  + z2 * ((1/24. - z * (1/720.)) + z2 * (1/40320. - z * (1/3628800.)) \
+  + z4 * ((1/479001600. - z * (1/87178291200.)) \
+    + z2 * (1/20922789888000. - z * (1/6402373705728000.)))))
+/* "p" + "e" = "x" times "y" exactly, by Dekker's product */
+#define FLEP_TWO_PROD(x, y, p, e, t, xh, yh) \
+  t = x * FLEP_SPLIT; \
+  xh = t - (t - x); \
+  t = y * FLEP_SPLIT; \
+  yh = t - (t - y); \
+  p = x * y; \
+  e = ((xh * yh - p) + xh * (y - yh) + (x - xh) * yh) + (x - xh) * (y - yh);
+/* log x as "hi" + "lo", from x = 2^k (1+f) and s = f/(2+f), as for the
+ * plain logarithm but with f^2 exact and the sum tracking its errors
+ */
+#define FLEP_LOG2(k, f, s, hi, lo, w, p, e, t, xh, yh) \
+  w = s * s; \
+  FLEP_TWO_PROD(f, f, p, e, t, xh, yh) \
+  hi = f - 0.5 * p; \
+  lo = (f - hi) - 0.5 * p; \
+  lo += s * (0.5 * p + FLEP_LOG_POLY(w, w * w, (w * w) * (w * w))) \
+    - 0.5 * e + k * FLEP_LN2_LO; \
+  p = k * FLEP_LN2_HI; \
+  e = p + hi; \
+  t = e - p; \
+  lo += (p - (e - t)) + (hi - t); \
+  hi = e + lo; \
+  lo = (e - hi) + lo;
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(FLEP_NO_SIMD)
+#define FLEP_SIMD
+#include <immintrin.h>
+
+typedef double FLEPv2d __attribute__((vector_size(16)));
+typedef double FLEPv4d __attribute__((vector_size(32)));
+typedef double FLEPv8d __attribute__((vector_size(64)));
+__extension__ typedef long long FLEPv2l __attribute__((vector_size(16)));
+__extension__ typedef long long FLEPv4l __attribute__((vector_size(32)));
+__extension__ typedef long long FLEPv8l __attribute__((vector_size(64)));
+
+/* lanes of "a" where mask "m" is set, of "b" elsewhere */
+#define FLEP_VSEL(V, L, m, a, b) \
+  ((V)(((L)(a) & (L)(m)) | ((L)(b) & ~(L)(m))))
+
+/* The functions over "W" lanes of doubles "V", with "L" the integer vector
+ * of the same width, for the instruction set "tgt" and named after "pfx".
+ * ANY(m) tells whether any lane of mask "m" is set. "z" is a vector of
+ * zeros, added to scalars to spread them over all lanes.
+ */
+#define FLEP_V_MATH(pfx, tgt, W, V, L, ANY) \
+/* e^(x+lo), for "lo" well below 1 ulp of "x" */ \
+__attribute__((target(tgt))) \
+static V pfx##vexp(V x, V lo) { \
+  V z = (V)((L)x & 0), t, n, r, r2, r4; \
+  L i, h; \
+  x = FLEP_VSEL(V, L, x < -746.0, z - 746.0, x); \
+  x = FLEP_VSEL(V, L, x > 710.0, z + 710.0, x); \
+  t = x * FLEP_INV_LN2 + FLEP_ROUND; \
+  n = t - FLEP_ROUND; \
+  i = (L)t - (L)(z + FLEP_ROUND); \
+  r = (x - n * FLEP_LN2_HI) - n * FLEP_LN2_LO + lo; \
+  r2 = r * r; \
+  r4 = r2 * r2; \
+  h = i >> 1; /* 2^i as two factors, each normal even if 2^i is not */ \
+  return FLEP_EXP_POLY(r, r2, r4) * (V)((h + 1023) << 52) \
+    * (V)((i - h + 1023) << 52); \
+} \
+/* f with x = 2^k (1+f), 1+f within [sqrt(1/2), sqrt(2)], for x > 0 */ \
+__attribute__((target(tgt))) \
+static V pfx##vreduce(V x, V* k) { \
+  V z = (V)((L)x & 0), m; \
+  L sub = (L)(x < 2.2250738585072014e-308), b, e; \
+  b = (L)FLEP_VSEL(V, L, sub, x * 18014398509481984.0, x); /* 2^54 */ \
+  e = ((b >> 52) & 0x7ff) - 1023 - (sub & 54); \
+  m = (V)((b & ((((L)z + 1) << 52) - 1)) | (((L)z + 0x3ff) << 52)); \
+  b = (L)(m > FLEP_SQRT2); \
+  *k = (V)(e - b + (L)(z + FLEP_ROUND)) - FLEP_ROUND; \
+  return FLEP_VSEL(V, L, b, m * 0.5, m) - 1; \
+} \
+__attribute__((target(tgt))) \
+static V pfx##vlog(V x) { \
+  V z = (V)((L)x & 0), k, f = pfx##vreduce(x, &k), s = f / (2 + f); \
+  V w = s * s, hfsq = 0.5 * f * f, y; \
+  y = k * FLEP_LN2_HI - ((hfsq - (s * (hfsq + FLEP_LOG_POLY(w, w * w, \
+    (w * w) * (w * w))) + k * FLEP_LN2_LO)) - f); \
+  y = FLEP_VSEL(V, L, x == 0, z - HUGE_VAL, y); \
+  y = FLEP_VSEL(V, L, x == HUGE_VAL, z + HUGE_VAL, y); \
+  return FLEP_VSEL(V, L, (x < 0) | (x != x), z - HUGE_VAL + HUGE_VAL, y); \
+} \
+/* x^y through y log x as hi + lo; "*bad" masks lanes left to libm */ \
+__attribute__((target(tgt))) \
+static V pfx##vpow(V x, V y, L* bad) { \
+  V k, f = pfx##vreduce(x, &k), s = f / (2 + f), hi, lo, w, p, e, t, xh, yh; \
+  FLEP_LOG2(k, f, s, hi, lo, w, p, e, t, xh, yh) \
+  lo *= y; \
+  FLEP_TWO_PROD(y, hi, p, e, t, xh, yh) \
+  *bad = ~((L)((x > 0) & (x < HUGE_VAL)) \
+    & (L)((p <= FLEP_POW_MAX) & (p >= -FLEP_POW_MAX))); \
+  return pfx##vexp(p, e + lo); \
+} \
+/* sin x, and cos x to "*c", for |x| up to FLEP_TRIG_MAX */ \
+__attribute__((target(tgt))) \
+static V pfx##vsincos(V x, V* c) { \
+  V z = (V)((L)x & 0), t = x * FLEP_2_PI + FLEP_ROUND, n = t - FLEP_ROUND; \
+  V r = ((x - n * FLEP_PI_2_1) - n * FLEP_PI_2_2) - n * FLEP_PI_2_3; \
+  V w = r * r, w2 = w * w, s = FLEP_SIN_POLY(r, w, w2, w2 * w2); \
+  V co = FLEP_COS_POLY(w, w2, w2 * w2); \
+  L q = (L)t & 3, odd = -(q & 1), sign = (L)(-z); /* n mod 4, as the */ \
+  /* low bits of FLEP_ROUND are 0, even where n is too large to be used */ \
+  /* by quadrant q: swapped in odd ones, sign flipped in two of them */ \
+  *c = (V)((L)FLEP_VSEL(V, L, odd, s, co) ^ (-((q + 1) >> 1 & 1) & sign)); \
+  return (V)((L)FLEP_VSEL(V, L, odd, co, s) ^ (-(q >> 1 & 1) & sign)); \
+} \
+/* up to W values at "x" as a vector, padded with ones */ \
+__attribute__((target(tgt))) \
+static V pfx##vload(const double* x, int n) { \
+  double t[W]; \
+  V v; \
+  int j; \
+  if (n == W) { \
+    memcpy(&v, x, sizeof(v)); \
+    return v; \
+  } \
+  for (j = 0; j < W; j++) t[j] = j < n ? x[j] : 1; \
+  memcpy(&v, t, sizeof(v)); \
+  return v; \
+} \
+__attribute__((target(tgt))) \
+static void pfx##unary(double* x, int m, int op) { \
+  int k, j, n; \
+  for (k = 0; k < m; k += n) { \
+    V v, u, c; \
+    L bad; \
+    n = m - k < W ? m - k : W; \
+    v = pfx##vload(x + k, n); \
+    if (op == FLEP_EXP) u = pfx##vexp(v, (V)((L)v & 0)); \
+    else if (op == FLEP_LOG) u = pfx##vlog(v); \
+    else { \
+      u = pfx##vsincos(v, &c); \
+      if (op == FLEP_COS) u = c; \
+      else if (op == FLEP_TAN) u /= c; \
+      bad = ~(L)((v <= FLEP_TRIG_MAX) & (v >= -FLEP_TRIG_MAX)); \
+      if (ANY(bad)) { \
+	for (j = 0; j < n; j++) { \
+	  if (bad[j]) u[j] = op == FLEP_SIN ? sin(v[j]) \
+	    : op == FLEP_COS ? cos(v[j]) : tan(v[j]); \
+	} \
+      } \
+    } \
+    memcpy(x + k, &u, n * sizeof(double)); \
+  } \
+} \
+__attribute__((target(tgt))) \
+static void pfx##pow(double* y, const double* x, int m) { \
+  int k, j, n; \
+  for (k = 0; k < m; k += n) { \
+    V a, b, u; \
+    L bad; \
+    n = m - k < W ? m - k : W; \
+    a = pfx##vload(y + k, n); \
+    b = pfx##vload(x + k, n); \
+    u = pfx##vpow(a, b, &bad); \
+    if (ANY(bad)) { \
+      for (j = 0; j < n; j++) if (bad[j]) u[j] = pow(a[j], b[j]); \
+    } \
+    memcpy(y + k, &u, n * sizeof(double)); \
+  } \
+} \
+__attribute__((target(tgt))) \
+static void pfx##sincos(const double* x, double* s, double* c, int m) { \
+  int k, j, n; \
+  for (k = 0; k < m; k += n) { \
+    V v, u, w; \
+    L bad; \
+    n = m - k < W ? m - k : W; \
+    v = pfx##vload(x + k, n); \
+    u = pfx##vsincos(v, &w); \
+    bad = ~(L)((v <= FLEP_TRIG_MAX) & (v >= -FLEP_TRIG_MAX)); \
+    if (ANY(bad)) { \
+      for (j = 0; j < n; j++) { \
+	double sj, cj; \
+	if (!bad[j]) continue; \
+	flep_sincos(v[j], &sj, &cj); \
+	u[j] = sj; \
+	w[j] = cj; \
+      } \
+    } \
+    memcpy(s + k, &u, n * sizeof(double)); \
+    memcpy(c + k, &w, n * sizeof(double)); \
+  } \
+} \
+static const struct FLEPMath pfx##math = {pfx##unary, pfx##pow, \
+  pfx##sincos};
+#define FLEP_ANY2(m) _mm_movemask_pd((__m128d)(m))
+#define FLEP_ANY4(m) _mm256_movemask_pd((__m256d)(m))
+#define FLEP_ANY8(m) _mm512_test_epi64_mask((__m512i)(m), (__m512i)(m))
+FLEP_V_MATH(flep_sse2_, "sse2", 2, FLEPv2d, FLEPv2l, FLEP_ANY2)
+FLEP_V_MATH(flep_avx2_, "avx2", 4, FLEPv4d, FLEPv4l, FLEP_ANY4)
+FLEP_V_MATH(flep_avx512_, "avx512f", 8, FLEPv8d, FLEPv8l, FLEP_ANY8)
+
+/* scalars as lane 0 of the SSE2 functions */
+static double flep_m_exp(double x) {
+  FLEPv2d v;
+  v[0] = v[1] = x;
+  return flep_sse2_vexp(v, (FLEPv2d)((FLEPv2l)v & 0))[0];
+}
+
+static double flep_m_log(double x) {
+  FLEPv2d v;
+  v[0] = v[1] = x;
+  return flep_sse2_vlog(v)[0];
+}
+
+static double flep_m_pow(double x, double y) {
+  FLEPv2d u, v;
+  FLEPv2l bad;
+  u[0] = u[1] = x;
+  v[0] = v[1] = y;
+  u = flep_sse2_vpow(u, v, &bad);
+  return bad[0] ? pow(x, y) : u[0];
+}
+
+static void flep_m_sincos(double x, double* s, double* c) {
+  FLEPv2d v, w;
+  if (!(fabs(x) <= FLEP_TRIG_MAX)) {
+    flep_sincos(x, s, c);
+    return;
+  }
+  v[0] = v[1] = x;
+  *s = flep_sse2_vsincos(v, &w)[0];
+  *c = w[0];
+}
+#else
+/* f with x = 2^k (1+f) as above, for x > 0 */
+static double flep_m_reduce(double x, double* k) {
+  int e;
+  double m = 2 * frexp(x, &e);
+  if (m > FLEP_SQRT2) m *= 0.5;
+  else e--;
+  *k = e;
+  return m - 1;
+}
+
+/* e^(x+lo), for "lo" well below 1 ulp of "x" */
+static double flep_m_exp2(double x, double lo) {
+  double n, r, r2, r4;
+  if (!(x > -746 && x < 710)) return exp(x);
+  n = floor(x * FLEP_INV_LN2 + 0.5);
+  r = (x - n * FLEP_LN2_HI) - n * FLEP_LN2_LO + lo;
+  r2 = r * r;
+  r4 = r2 * r2;
+  return ldexp(FLEP_EXP_POLY(r, r2, r4), (int)n);
+}
+
+static double flep_m_exp(double x) {
+  return flep_m_exp2(x, 0);
+}
+
+static double flep_m_log(double x) {
+  double k, f, s, w, hfsq;
+  if (!(x > 0 && x < HUGE_VAL)) return log(x);
+  f = flep_m_reduce(x, &k);
+  s = f / (2 + f);
+  w = s * s;
+  hfsq = 0.5 * f * f;
+  return k * FLEP_LN2_HI - ((hfsq - (s * (hfsq + FLEP_LOG_POLY(w, w * w,
+    (w * w) * (w * w))) + k * FLEP_LN2_LO)) - f);
+}
+
+static double flep_m_pow(double x, double y) {
+  double k, f, s, hi, lo, w, p, e, t, xh, yh;
+  if (!(x > 0 && x < HUGE_VAL)) return pow(x, y);
+  f = flep_m_reduce(x, &k);
+  s = f / (2 + f);
+  FLEP_LOG2(k, f, s, hi, lo, w, p, e, t, xh, yh)
+  lo *= y;
+  FLEP_TWO_PROD(y, hi, p, e, t, xh, yh)
+  if (!(p <= FLEP_POW_MAX && p >= -FLEP_POW_MAX)) return pow(x, y);
+  return flep_m_exp2(p, e + lo);
+}
+
+static void flep_m_sincos(double x, double* s, double* c) {
+  double n, r, w, w2, u, v;
+  int q;
+  if (!(fabs(x) <= FLEP_TRIG_MAX)) {
+    flep_sincos(x, s, c);
+    return;
+  }
+  n = floor(x * FLEP_2_PI + 0.5);
+  q = (int)(n - 4 * floor(n * 0.25));
+  r = ((x - n * FLEP_PI_2_1) - n * FLEP_PI_2_2) - n * FLEP_PI_2_3;
+  w = r * r;
+  w2 = w * w;
+  u = FLEP_SIN_POLY(r, w, w2, w2 * w2);
+  v = FLEP_COS_POLY(w, w2, w2 * w2);
+  *s = (q & 1) ? v : u;
+  *c = (q & 1) ? u : v;
+  if (q & 2) *s = -*s;
+  if ((q + 1) & 2) *c = -*c;
+}
+#endif
+
+static double flep_m_sin(double x) {
+  double s, c;
+  flep_m_sincos(x, &s, &c);
+  return s;
+}
+
+static double flep_m_cos(double x) {
+  double s, c;
+  flep_m_sincos(x, &s, &c);
+  return c;
+}
+
+static double flep_m_tan(double x) {
+  double s, c;
+  if (!(fabs(x) <= FLEP_TRIG_MAX)) return tan(x);
+  flep_m_sincos(x, &s, &c);
+  return s / c;
+}
+#ifndef FLEP_SIMD
+FLEP_C_MATH(flep_own_, double, FLEPMath, flep_m_sin, flep_m_cos, flep_m_tan,
+  flep_m_exp, flep_m_log, flep_m_pow, flep_m_sincos)
+#endif
+
+/* the math functions for "f", in "flep_eval" and in batches */
+#define FLEP_MATHFN(f, own, libm) ((f)->flags & FLEP_APPROX ? own : libm)
+static const struct FLEPMath* flep_math(const struct FLEP* f) {
+  if (!(f->flags & FLEP_APPROX)) return &flep_libm_math;
+#ifdef FLEP_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return &flep_avx512_math;
+  if (__builtin_cpu_supports("avx2")) return &flep_avx2_math;
+  return &flep_sse2_math;
+#else
+  return &flep_own_math;
+#endif
+}
+
+/* single precision always uses the C library */
+static const struct FLEPMathF* flep_mathf(const struct FLEP* f) {
+  (void)f;
+  return &flep_libmf_math;
+}
+
+/* no mysteries left - run the compiled expression, with the values below
+ * the top of the stack in a frame of "depth" slots which is local unless
+ * the expression is unusually deep. With GCC/clang each instruction jumps
+ * straight to the next one's handler through a table of label addresses;
+ * elsewhere, or with FLEP_NO_THREADED, a switch is used.
+ * Outputs of programs from "flep_parse_many" go to "out", if not null.
+ */
+#define FLEP_FRAME 64
+#if defined(__GNUC__) && !defined(FLEP_NO_THREADED)
+#define FLEP_THREADED
+#define FLEP_INSN_LABEL(n) &&flep_l_##n,
+#define FLEP_CASE(n) flep_l_##n
+#define FLEP_NEXT goto *labels[(++ip)->op]
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#else
+#define FLEP_CASE(n) case FLEP_I_##n
+#define FLEP_NEXT ++ip; continue
+#endif
+#ifdef FLEP_THREADED
+#define FLEP_LABELS \
+  static const void* const labels[] = { FLEP_INSNS(FLEP_INSN_LABEL) 0 };
+#define FLEP_DISPATCH goto *labels[ip->op];
+#define FLEP_DISPATCH_END
+#else
+#define FLEP_LABELS
+#define FLEP_DISPATCH for (;;) switch (ip->op) {
+#define FLEP_DISPATCH_END }
+#endif
+#define FLEP_ADD(u, v) ((u) + (v))
+#define FLEP_SUB(u, v) ((u) - (v))
+#define FLEP_MUL(u, v) ((u) * (v))
+#define FLEP_QUO(u, v) ((u) / (v))
+#define FLEP_BINARY_CASES(T, OP, F) \
+  FLEP_CASE(OP): x = F(r[ip->a], x); FLEP_NEXT; \
+  FLEP_CASE(OP##_RV): x = F(x, val[ip->b]); FLEP_NEXT; \
+  FLEP_CASE(OP##_RC): x = F(x, (T)k[ip->b]); FLEP_NEXT; \
+  FLEP_CASE(OP##_VV): r[ip->d] = x; x = F(val[ip->a], val[ip->b]); FLEP_NEXT; \
+  FLEP_CASE(OP##_VC): r[ip->d] = x; x = F(val[ip->a], (T)k[ip->b]); FLEP_NEXT; \
+  FLEP_CASE(OP##_CV): r[ip->d] = x; x = F((T)k[ip->a], val[ip->b]); FLEP_NEXT;
+#define FLEP_UNARY_CASE(OP, F) FLEP_CASE(OP): x = F(x); FLEP_NEXT;
+/* The interpreter over values of type "T" (with constants rounded to it),
+ * given the math functions to use for it
+ */
+#define FLEP_RUN(name, T, m_pow, m_sin, m_cos, m_tan, m_exp, m_log, m_abs, \
+  m_sqrt, m_sincos) \
+static T name(const struct FLEP* f, const T* val, T* out) { \
+  T frame[FLEP_FRAME], *r = frame, x = 0; \
+  const double* k = FLEP_DATA(f); \
+  const struct FLEPInsn* ip = FLEP_CODE(f); \
+  FLEP_LABELS \
+  if (f->depth + f->ntemp > FLEP_FRAME) { \
+    r = (T*)malloc((f->depth + f->ntemp) * sizeof(T)); \
+    if (!r) { \
+      if (out) FLEP_FILL_NAN(T, f, 1, out) \
+      return (T)FLEP_NAN; \
+    } \
+  } \
+  FLEP_DISPATCH \
+  FLEP_CASE(UNARY_MINUS): x = -x; FLEP_NEXT; \
+  FLEP_BINARY_CASES(T, PLUS, FLEP_ADD) \
+  FLEP_BINARY_CASES(T, MINUS, FLEP_SUB) \
+  FLEP_BINARY_CASES(T, MULT, FLEP_MUL) \
+  FLEP_BINARY_CASES(T, DIV, FLEP_QUO) \
+  FLEP_BINARY_CASES(T, POWER, m_pow) \
+  FLEP_CASE(VAR): r[ip->d] = x; x = val[ip->a]; FLEP_NEXT; \
+  FLEP_CASE(CONST): r[ip->d] = x; x = (T)k[ip->a]; FLEP_NEXT; \
+  FLEP_UNARY_CASE(SIN, m_sin) \
+  FLEP_UNARY_CASE(COS, m_cos) \
+  FLEP_UNARY_CASE(TAN, m_tan) \
+  FLEP_UNARY_CASE(EXP, m_exp) \
+  FLEP_UNARY_CASE(LOG, m_log) \
+  FLEP_UNARY_CASE(ABS, m_abs) \
+  FLEP_UNARY_CASE(SQRT, m_sqrt) \
+  FLEP_CASE(MULTPLUS_RC): x = r[ip->a] + x * (T)k[ip->b]; FLEP_NEXT; \
+  FLEP_CASE(STORE): r[ip->a] = x; FLEP_NEXT; \
+  FLEP_CASE(LOAD): r[ip->d] = x; x = r[ip->a]; FLEP_NEXT; \
+  FLEP_CASE(SINCOS): m_sincos(x, &x, r + ip->a); FLEP_NEXT; \
+  FLEP_CASE(COSSIN): m_sincos(x, r + ip->a, &x); FLEP_NEXT; \
+  FLEP_CASE(OUTPUT): if (out) out[ip->a] = x; FLEP_NEXT; \
+  FLEP_CASE(END): \
+    if (r != frame) free(r); \
+    return x; \
+  FLEP_DISPATCH_END \
+}
+FLEP_RUN(flep_run_libm, double, pow, sin, cos, tan, exp, log, fabs, sqrt,
+  flep_sincos)
+FLEP_RUN(flep_run_own, double, flep_m_pow, flep_m_sin, flep_m_cos,
+  flep_m_tan, flep_m_exp, flep_m_log, fabs, sqrt, flep_m_sincos)
+FLEP_RUN(flep_runf, float, FLEP_F(pow), FLEP_F(sin), FLEP_F(cos),
+  FLEP_F(tan), FLEP_F(exp), FLEP_F(log), FLEP_F(fabs), FLEP_F(sqrt),
+  flep_sincosf)
+#ifdef FLEP_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+static double flep_run(const struct FLEP* f, const double* val, double* out) {
+  return (f->flags & FLEP_APPROX) ? flep_run_own(f, val, out)
+    : flep_run_libm(f, val, out);
+}
+
+/* Profiling, compiled in with FLEP_PROFILE (and left out entirely without
+ * it). Counters of each expression evaluated are found by its address in a
+ * hash table, under a single lock. One in FLEP_PROFILE_PERIOD scalar
+ * evaluations of an expression is timed opcode by opcode, walking its
+ * opcodes rather than its instructions (which fuse them) so the ticks can
+ * be told apart (samples interrupted by the system are dropped); batches
+ * are timed as a whole. Expressions are forgotten by "flep_free"; another
+ * one found at the same address with a different size restarts the
+ * counters.
+ */
+#ifdef FLEP_PROFILE
+#ifndef FLEP_PROFILE_PERIOD
+#define FLEP_PROFILE_PERIOD 64
+#endif
+#define FLEP_PROFILE_OUTLIER 100 /* times the ticks of reading the ticks:
+				  * no opcode takes as long unless the
+				  * thread was interrupted */
+#define FLEP_PROFILE_SPIKE 4 /* times the mean ticks of the samples kept,
+			      * past FLEP_PROFILE_WARMUP of them */
+#define FLEP_PROFILE_WARMUP 8
+
+struct FLEPProfile {
+  const struct FLEP* f;
+  int size, nt; /* of "f" when first seen */
+  int* text; /* copy of the opcodes of "f", which may be gone */
+  unsigned long calls, rows, samples;
+  double* ticks; /* per opcode, summed over samples */
+  double total; /* summed over opcodes and samples */
+  double batch_ticks;
+  struct FLEPProfile* next;
+};
+
+static pthread_mutex_t flep_prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct FLEPProfile** flep_prof_bucket;
+static size_t flep_prof_nbucket, flep_prof_n;
+static double flep_prof_overhead = -1; /* ticks of reading the ticks */
+
+/* timestamp counter (cycles) where there is one, else nanoseconds */
+static double flep_ticks(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return (double)__builtin_ia32_rdtsc();
+#elif defined(__unix__)
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return 1e9 * (double)t.tv_sec + (double)t.tv_nsec;
+#else
+  return (double)clock();
+#endif
+}
+
+static int flep_compare_ticks(const void* x, const void* y) {
+  double u = *(const double*)x, v = *(const double*)y;
+  return (u > v) - (u < v);
+}
+
+/* median ticks between opcodes doing nothing, as "flep_run_timed" does */
+static double flep_profile_calibrate(void) {
+  double d[65], t0 = flep_ticks(), t1;
+  int i;
+  for (i = 0; i < 65; i++) {
+    t1 = flep_ticks();
+    d[i] = t1 - t0;
+    t0 = t1;
   }
+  qsort(d + 1, 64, sizeof(double), flep_compare_ticks);
+  return d[32];
 }
 
+#define FLEP_PROF_HASH(f) ((size_t)(f) / 8 * 2654435761UL)
+
+/* counters of "f", made if "create"; call with the lock held */
+static struct FLEPProfile* flep_profile_of(const struct FLEP* f,
+  int create) {
+  struct FLEPProfile *p = 0, **head;
+  size_t i;
+  if (flep_prof_nbucket) {
+    p = flep_prof_bucket[FLEP_PROF_HASH(f) % flep_prof_nbucket];
+    while (p && p->f != f) p = p->next;
+  }
+  if (p && p->size == f->size && p->nt == f->nt) return p;
+  if (!create) return 0;
+  if (!p) {
+    if (flep_prof_n >= flep_prof_nbucket) {
+      size_t n = flep_prof_nbucket ? 2 * flep_prof_nbucket : 64;
+      struct FLEPProfile** b = (struct FLEPProfile**)calloc(n, sizeof(*b));
+      for (i = 0; i < flep_prof_nbucket; i++) {
+	while ((p = flep_prof_bucket[i])) {
+	  flep_prof_bucket[i] = p->next;
+	  p->next = b[FLEP_PROF_HASH(p->f) % n];
+	  b[FLEP_PROF_HASH(p->f) % n] = p;
+	}
+      }
+      free(flep_prof_bucket);
+      flep_prof_bucket = b;
+      flep_prof_nbucket = n;
+    }
+    p = (struct FLEPProfile*)calloc(1, sizeof(*p));
+    head = flep_prof_bucket + FLEP_PROF_HASH(f) % flep_prof_nbucket;
+    p->next = *head;
+    *head = p;
+    flep_prof_n++;
+  }
+  free(p->text);
+  free(p->ticks);
+  p->f = f;
+  p->size = f->size;
+  p->nt = f->nt;
+  p->text = (int*)malloc(f->nt * sizeof(int));
+  memcpy(p->text, FLEP_TEXT(f), f->nt * sizeof(int));
+  p->ticks = (double*)calloc(f->nt, sizeof(double));
+  p->calls = p->rows = p->samples = 0;
+  p->total = p->batch_ticks = 0;
+  if (flep_prof_overhead < 0) flep_prof_overhead = flep_profile_calibrate();
+  return p;
+}
+
+/* Same as "flep_run", walking the opcodes of "f" and adding the ticks of
+ * each to "ticks"
+ */
+static double flep_run_timed(const struct FLEP* f, const double* val,
+  double* out, double* ticks) {
+  const int* text = FLEP_TEXT(f);
+  double *stack = (double*)malloc((f->depth + 2) * sizeof(double));
+  double *st = stack, *r = (double*)malloc((f->ntemp + 1) * sizeof(double));
+  double result = 0, t0 = flep_ticks(), t1;
+  int ip;
+  for (ip = 0;; ip++) {
+    int idx = FLEP_OPPARM(text[ip]);
+    switch (FLEP_OPCODE(text[ip])) {
+      case FLEP_UNARY_MINUS: *st = -*st; break;
+      case FLEP_PLUS: st--; *st += st[1]; break;
+      case FLEP_MINUS: st--; *st -= st[1]; break;
+      case FLEP_MULT: st--; *st *= st[1]; break;
+      case FLEP_DIV: st--; *st /= st[1]; break;
+      case FLEP_POWER:
+	st--;
+	*st = FLEP_MATHFN(f, flep_m_pow, pow)(*st, st[1]);
+	break;
+      case FLEP_VAR: *++st = val[idx]; break;
+      case FLEP_CONST: *++st = FLEP_DATA(f)[idx]; break;
+      case FLEP_SIN: *st = FLEP_MATHFN(f, flep_m_sin, sin)(*st); break;
+      case FLEP_COS: *st = FLEP_MATHFN(f, flep_m_cos, cos)(*st); break;
+      case FLEP_TAN: *st = FLEP_MATHFN(f, flep_m_tan, tan)(*st); break;
+      case FLEP_EXP: *st = FLEP_MATHFN(f, flep_m_exp, exp)(*st); break;
+      case FLEP_LOG: *st = FLEP_MATHFN(f, flep_m_log, log)(*st); break;
+      case FLEP_ABS: *st = fabs(*st); break;
+      case FLEP_SQRT: *st = sqrt(*st); break;
+      case FLEP_STORE: r[idx] = *st; break;
+      case FLEP_LOAD: *++st = r[idx]; break;
+      case FLEP_SINCOS:
+	FLEP_MATHFN(f, flep_m_sincos, flep_sincos)(*st,
+	  idx & 1 ? r + (idx >> 1) : st, idx & 1 ? st : r + (idx >> 1));
+	break;
+      case FLEP_OUTPUT:
+	result = *st--;
+	if (out) out[idx] = result;
+	break;
+      case FLEP_END:
+	if (!f->nout) result = *st;
+	free(stack);
+	free(r);
+	return result;
+    }
+    t1 = flep_ticks();
+    if (t1 - t0 > flep_prof_overhead) ticks[ip] += t1 - t0 - flep_prof_overhead;
+    t0 = t1;
+  }
+}
+
+/* "flep_run", counted and sometimes timed */
+static double flep_run_profiled(const struct FLEP* f, const double* val,
+  double* out) {
+  struct FLEPProfile* p;
+  double *ticks, x, limit, sum = 0;
+  int timed, i;
+  pthread_mutex_lock(&flep_prof_lock);
+  p = flep_profile_of(f, 1);
+  timed = !f->stride && p->calls++ % FLEP_PROFILE_PERIOD == 0;
+  pthread_mutex_unlock(&flep_prof_lock);
+  if (!timed) return flep_run(f, val, out);
+  ticks = (double*)calloc(f->nt, sizeof(double));
+  x = flep_run_timed(f, val, out, ticks);
+  limit = FLEP_PROFILE_OUTLIER * (flep_prof_overhead > 1 ?
+    flep_prof_overhead : 1);
+  for (i = 0; i < f->nt && ticks[i] < limit; i++) sum += ticks[i];
+  if (i == f->nt) { /* nor is a whole sample several times the others */
+    pthread_mutex_lock(&flep_prof_lock);
+    p = flep_profile_of(f, 1);
+    if (p->samples < FLEP_PROFILE_WARMUP ||
+      sum <= FLEP_PROFILE_SPIKE * p->total / p->samples) {
+      p->samples++;
+      p->total += sum;
+      for (i = 0; i < f->nt; i++) p->ticks[i] += ticks[i];
+    }
+    pthread_mutex_unlock(&flep_prof_lock);
+  }
+  free(ticks);
+  return x;
+}
+
+/* count "calls" evaluations and "rows" rows taking "ticks" */
+static void flep_profile_count(const struct FLEP* f, unsigned long calls,
+  size_t rows, double ticks) {
+  struct FLEPProfile* p;
+  pthread_mutex_lock(&flep_prof_lock);
+  p = flep_profile_of(f, 1);
+  p->calls += calls;
+  p->rows += rows;
+  p->batch_ticks += ticks;
+  pthread_mutex_unlock(&flep_prof_lock);
+}
+
+#define FLEP_SCALAR flep_run_profiled
+#define FLEP_PROFILE_BATCH(f, n, run) { \
+  double flep_t0 = flep_ticks(); \
+  run; \
+  flep_profile_count(f, 0, n, flep_ticks() - flep_t0); \
+}
+#else
+#define FLEP_SCALAR flep_run
+#define FLEP_PROFILE_BATCH(f, n, run) run
+#endif
+
+double flep_eval(const struct FLEP* f, double* val) {
+  return FLEP_SCALAR(f, val, 0);
+}
+
+float flep_evalf(const struct FLEP* f, const float* val) {
+  if (f->stride) return (float)FLEP_NAN;
+#ifdef FLEP_PROFILE
+  flep_profile_count(f, 1, 0, 0);
+#endif
+  return flep_runf(f, val, 0);
+}
+
+double flep_eval_record(const struct FLEP* f, const void* record) {
+  return FLEP_SCALAR(f, (double*)record, 0);
+}
+
+void flep_eval_many(const struct FLEP* f, double* val, double* out) {
+  double x = FLEP_SCALAR(f, val, out);
+  if (!f->nout) out[0] = x;
+}
+
+/* value and partial derivatives (forward mode) over the variables used,
+ * in order ("dindex" maps variables to them)
+ */
+struct FLEPDual {
+  double v, d[7];
+};
+
+/* y = a * x (the "nv" derivatives only) */
+static void flep_dscale(struct FLEPDual* y, double a,
+  const struct FLEPDual* x, int nv) {
+  int i;
+  for (i = 0; i < nv; i++) y->d[i] = a * x->d[i];
+}
+
+/* Same as "flep_eval", walking the opcodes with a value and gradient in each
+ * slot. Derivatives where a function is not differentiable (abs at 0, sqrt
+ * at 0) are those of the nearest side, or infinite, as the formulas give.
+ */
+double flep_eval_grad(const struct FLEP* f, double* val, double* grad) {
+  const int* text = FLEP_TEXT(f);
+  struct FLEPDual frame[FLEP_FRAME / 4], *stack = frame, *x, *y, last;
+  int ip, i, sp = -1, n = f->depth + f->ntemp, nv = 0, dindex[7];
+  double u, w;
+  if (f->stride) { /* records, of which "val" is not one */
+    for (i = 0; i < 7; i++) grad[i] = FLEP_NAN;
+    return FLEP_NAN;
+  }
+  for (i = 0; i < 7; i++) {
+    dindex[i] = nv;
+    if (f->vars >> i & 1) nv++;
+  }
+  if (n > FLEP_FRAME / 4) {
+    stack = (struct FLEPDual*)malloc(n * sizeof(*stack));
+    if (!stack) {
+      for (i = 0; i < 7; i++) grad[i] = FLEP_NAN;
+      return FLEP_NAN;
+    }
+  }
+  memset(&last, 0, sizeof(last));
+  for (ip = 0;; ip++) {
+    int op = FLEP_OPCODE(text[ip]), idx = FLEP_OPPARM(text[ip]);
+    x = stack + (sp > 0 ? sp : 0);
+    y = stack + (sp > 1 ? sp - 1 : 0);
+    switch (op) {
+      case FLEP_UNARY_MINUS:
+	x->v = -x->v;
+	flep_dscale(x, -1, x, nv);
+	continue;
+      case FLEP_PLUS:
+	y->v += x->v;
+	for (i = 0; i < nv; i++) y->d[i] += x->d[i];
+	--sp; continue;
+      case FLEP_MINUS:
+	y->v -= x->v;
+	for (i = 0; i < nv; i++) y->d[i] -= x->d[i];
+	--sp; continue;
+      case FLEP_MULT:
+	for (i = 0; i < nv; i++) y->d[i] = y->d[i] * x->v + y->v * x->d[i];
+	y->v *= x->v;
+	--sp; continue;
+      case FLEP_DIV:
+	/* (y/x)' = (y' - (y/x) x') / x */
+	y->v /= x->v;
+	for (i = 0; i < nv; i++) y->d[i] = (y->d[i] - y->v * x->d[i]) / x->v;
+	--sp; continue;
+      case FLEP_POWER:
+	/* (y^x)' = x y^(x-1) y' + y^x log(y) x', each term only where its
+	 * derivative is not zero, so that e.g. (-2)^3 still works
+	 */
+	u = FLEP_MATHFN(f, flep_m_pow, pow)(y->v, x->v);
+	w = 0;
+	for (i = 0; i < nv; i++) {
+	  double d = 0;
+	  if (y->d[i] != 0) {
+	    if (w == 0) w = x->v * FLEP_MATHFN(f, flep_m_pow, pow)(y->v,
+	      x->v - 1);
+	    d = w * y->d[i];
+	  }
+	  if (x->d[i] != 0) {
+	    d += u * FLEP_MATHFN(f, flep_m_log, log)(y->v) * x->d[i];
+	  }
+	  y->d[i] = d;
+	}
+	y->v = u;
+	--sp; continue;
+      case FLEP_VAR:
+	x = stack + ++sp;
+	x->v = val[idx];
+	memset(x->d, 0, sizeof(x->d));
+	x->d[dindex[idx]] = 1;
+	continue;
+      case FLEP_CONST:
+	x = stack + ++sp;
+	x->v = FLEP_DATA(f)[idx];
+	memset(x->d, 0, sizeof(x->d));
+	continue;
+      case FLEP_SIN:
+	flep_dscale(x, FLEP_MATHFN(f, flep_m_cos, cos)(x->v), x, nv);
+	x->v = FLEP_MATHFN(f, flep_m_sin, sin)(x->v);
+	continue;
+      case FLEP_COS:
+	flep_dscale(x, -FLEP_MATHFN(f, flep_m_sin, sin)(x->v), x, nv);
+	x->v = FLEP_MATHFN(f, flep_m_cos, cos)(x->v);
+	continue;
+      case FLEP_TAN:
+	x->v = FLEP_MATHFN(f, flep_m_tan, tan)(x->v);
+	flep_dscale(x, 1 + x->v * x->v, x, nv);
+	continue;
+      case FLEP_EXP:
+	x->v = FLEP_MATHFN(f, flep_m_exp, exp)(x->v);
+	flep_dscale(x, x->v, x, nv);
+	continue;
+      case FLEP_LOG:
+	flep_dscale(x, 1 / x->v, x, nv);
+	x->v = FLEP_MATHFN(f, flep_m_log, log)(x->v);
+	continue;
+      case FLEP_ABS:
+	if (x->v < 0) flep_dscale(x, -1, x, nv);
+	x->v = fabs(x->v);
+	continue;
+      case FLEP_SQRT:
+	x->v = sqrt(x->v);
+	flep_dscale(x, 0.5 / x->v, x, nv);
+	continue;
+      case FLEP_STORE: stack[f->depth + idx] = *x; continue;
+      case FLEP_LOAD: stack[++sp] = stack[f->depth + idx]; continue;
+      case FLEP_SINCOS:
+	/* sin to the top and cos to the temporary, or the other way round */
+	y = stack + f->depth + (idx >> 1);
+	FLEP_MATHFN(f, flep_m_sincos, flep_sincos)(x->v, &u, &w);
+	flep_dscale(y, (idx & 1) ? w : -u, x, nv);
+	flep_dscale(x, (idx & 1) ? -u : w, x, nv);
+	x->v = (idx & 1) ? w : u;
+	y->v = (idx & 1) ? u : w;
+	continue;
+      case FLEP_OUTPUT: last = *x; --sp; continue;
+      case FLEP_END: break;
+    }
+    break;
+  }
+  if (!f->nout) last = stack[0];
+  if (stack != frame) free(stack);
+  for (i = 0; i < 7; i++) {
+    grad[i] = (f->vars >> i & 1) ? last.d[dindex[i]] : 0;
+  }
+  return last.v;
+}
+
+/* Evaluation context remembering the value of every subtree of the opcodes
+ * from one call to the next. Subtrees are ranges of the opcodes: each one
+ * but FLEP_OUTPUT ends a subtree, and those starting at the same opcode are
+ * nested and depend on growing sets of variables. At each opcode starting
+ * subtrees, the largest one not depending on variables changed since the
+ * last call is skipped, and its value pushed from the previous call.
+ */
+struct FLEPContext {
+  const struct FLEP* f;
+  int* mask; /* per opcode, variables its subtree depends on */
+  int* up; /* per opcode, end of the next larger subtree with its start */
+  int* leaf; /* per opcode, whether subtrees start at it */
+  double* cache; /* per opcode, value of its subtree */
+  double* temp; /* temporaries, kept like the subtrees storing them */
+  double* stack;
+  int* plan; /* opcodes run for "dirty", -1 - end for skipped subtrees */
+  int dirty; /* variables "plan" is for, -1 before the first call and -2
+	      * after it (all opcodes) */
+};
+
+/* opcodes to run when the variables in "dirty" changed, all if -1 */
+static void flep_context_plan(struct FLEPContext* c, int dirty) {
+  const int* text = FLEP_TEXT(c->f);
+  int ip, n = 0;
+  for (ip = 0;; ip++) {
+    if (dirty != -1 && c->leaf[ip] && !(c->mask[ip] & dirty)) {
+      /* largest subtree starting here with no changed variables */
+      int end = ip;
+      while (c->up[end] >= 0 && !(c->mask[c->up[end]] & dirty)) {
+	end = c->up[end];
+      }
+      c->plan[n++] = -1 - end;
+      ip = end;
+      continue;
+    }
+    c->plan[n++] = ip;
+    if (FLEP_OPCODE(text[ip]) == FLEP_END) return;
+  }
+}
+
+struct FLEPContext* flep_context_new(const struct FLEP* f) {
+  const int* text = FLEP_TEXT(f);
+  struct FLEPContext* c;
+  int *start, *last, *stack, *tmask, i, sp = -1;
+  if (f->stride) return 0;
+  c = (struct FLEPContext*)malloc(sizeof(*c));
+  c->f = f;
+  c->mask = (int*)malloc(f->nt * sizeof(int));
+  c->up = (int*)malloc(f->nt * sizeof(int));
+  c->leaf = (int*)calloc(f->nt, sizeof(int));
+  c->cache = (double*)malloc(f->nt * sizeof(double));
+  c->temp = (double*)malloc((f->ntemp + 1) * sizeof(double));
+  c->stack = (double*)malloc((f->depth + 2) * sizeof(double)); /* from 1 */
+  c->plan = (int*)malloc(f->nt * sizeof(int));
+  c->dirty = -1;
+  flep_context_plan(c, -1);
+  start = (int*)malloc(f->nt * sizeof(int));
+  last = (int*)malloc(f->nt * sizeof(int));
+  stack = (int*)malloc((f->depth + 1) * sizeof(int));
+  tmask = (int*)calloc(f->ntemp + 1, sizeof(int));
+  /* "stack" holds the opcodes ending the subtrees on the stack */
+  for (i = 0; i < f->nt - 1; i++) {
+    int op = FLEP_OPCODE(text[i]), parm = FLEP_OPPARM(text[i]);
+    last[i] = -1;
+    c->up[i] = -1;
+    switch (op) {
+      case FLEP_VAR: case FLEP_CONST: case FLEP_LOAD:
+	c->mask[i] = (op == FLEP_VAR) ? 1 << parm :
+	  (op == FLEP_LOAD) ? tmask[parm] : 0;
+	start[i] = i;
+	c->leaf[i] = 1;
+	stack[++sp] = i;
+	break;
+      case FLEP_PLUS: case FLEP_MINUS: case FLEP_MULT: case FLEP_DIV:
+      case FLEP_POWER:
+	sp--;
+	c->mask[i] = c->mask[stack[sp]] | c->mask[stack[sp + 1]];
+	start[i] = start[stack[sp]];
+	stack[sp] = i;
+	break;
+      case FLEP_OUTPUT:
+	c->mask[i] = 0;
+	start[i] = -1;
+	sp--;
+	continue;
+      default: /* unary, including FLEP_STORE and FLEP_SINCOS */
+	c->mask[i] = c->mask[stack[sp]];
+	start[i] = start[stack[sp]];
+	stack[sp] = i;
+	if (op == FLEP_STORE) tmask[parm] = c->mask[i];
+	if (op == FLEP_SINCOS) tmask[parm >> 1] = c->mask[i];
+    }
+    /* link the previous subtree with the same start to this one */
+    if (last[start[i]] >= 0) c->up[last[start[i]]] = i;
+    last[start[i]] = i;
+  }
+  free(start);
+  free(last);
+  free(stack);
+  free(tmask);
+  return c;
+}
+
+double flep_context_eval(struct FLEPContext* c, double* val, int dirty) {
+  const struct FLEP* f = c->f;
+  const double* k = FLEP_DATA(f);
+  const int* text = FLEP_TEXT(f);
+  const int* plan;
+  double *st = c->stack, *r = c->temp, *cache = c->cache, result = 0;
+  int ip;
+  /* the first call computes everything, whatever is "dirty" */
+  dirty &= 127;
+  if (c->dirty == -1) {
+    c->dirty = -2;
+  } else if (c->dirty != dirty) {
+    flep_context_plan(c, dirty);
+    c->dirty = dirty;
+  }
+  for (plan = c->plan;; plan++) {
+    if ((ip = *plan) < 0) {
+      *++st = cache[-1 - ip];
+      continue;
+    }
+    switch (FLEP_OPCODE(text[ip])) {
+      case FLEP_UNARY_MINUS: *st = -*st; break;
+      case FLEP_PLUS: st--; *st += st[1]; break;
+      case FLEP_MINUS: st--; *st -= st[1]; break;
+      case FLEP_MULT: st--; *st *= st[1]; break;
+      case FLEP_DIV: st--; *st /= st[1]; break;
+      case FLEP_POWER:
+	st--;
+	*st = FLEP_MATHFN(f, flep_m_pow, pow)(*st, st[1]);
+	break;
+      case FLEP_VAR: *++st = val[FLEP_OPPARM(text[ip])]; break;
+      case FLEP_CONST: *++st = k[FLEP_OPPARM(text[ip])]; break;
+      case FLEP_SIN: *st = FLEP_MATHFN(f, flep_m_sin, sin)(*st); break;
+      case FLEP_COS: *st = FLEP_MATHFN(f, flep_m_cos, cos)(*st); break;
+      case FLEP_TAN: *st = FLEP_MATHFN(f, flep_m_tan, tan)(*st); break;
+      case FLEP_EXP: *st = FLEP_MATHFN(f, flep_m_exp, exp)(*st); break;
+      case FLEP_LOG: *st = FLEP_MATHFN(f, flep_m_log, log)(*st); break;
+      case FLEP_ABS: *st = fabs(*st); break;
+      case FLEP_SQRT: *st = sqrt(*st); break;
+      case FLEP_STORE: r[FLEP_OPPARM(text[ip])] = *st; break;
+      case FLEP_LOAD: *++st = r[FLEP_OPPARM(text[ip])]; break;
+      case FLEP_SINCOS: {
+	int t = FLEP_OPPARM(text[ip]);
+	FLEP_MATHFN(f, flep_m_sincos, flep_sincos)(*st,
+	  t & 1 ? r + (t >> 1) : st, t & 1 ? st : r + (t >> 1));
+	break;
+      }
+      case FLEP_OUTPUT: result = *st--; continue;
+      case FLEP_END:
+	return f->nout ? result : c->stack[1];
+    }
+    cache[ip] = *st;
+  }
+}
+
+void flep_context_free(struct FLEPContext* c) {
+  if (!c) return;
+  free(c->mask);
+  free(c->up);
+  free(c->leaf);
+  free(c->cache);
+  free(c->temp);
+  free(c->stack);
+  free(c->plan);
+  free(c);
+}
+
+/* Kernels used by "flep_eval_batch" for the opcodes which map onto vector
+ * instructions. Each works over "m" contiguous lanes of a stack block.
+ * The plain C versions are always available; on x86-64 GCC/clang the SSE2,
+ * AVX2 and AVX-512 versions are compiled as well and the widest one the CPU
+ * supports is picked at each call. Define FLEP_NO_SIMD to leave them out.
+ * Each comes in double and, for "flep_eval_batchf", float ("f" suffix).
+ */
+struct FLEPKernels {
+  void (*binary[4])(double* y, const double* x, int m); /* + - * / */
+  void (*unary[3])(double* x, int m); /* unary minus, abs, sqrt */
+  void (*fill)(double* x, double c, int m);
+};
+struct FLEPKernelsF {
+  void (*binary[4])(float* y, const float* x, int m);
+  void (*unary[3])(float* x, int m);
+  void (*fill)(float* x, float c, int m);
+};
+
+#define FLEP_C_BINARY(name, T, op) \
+static void name(T* y, const T* x, int m) { \
+  int k; \
+  for (k = 0; k < m; k++) y[k] op x[k]; \
+}
+#define FLEP_C_UNARY(name, T, expr) \
+static void name(T* x, int m) { \
+  int k; \
+  for (k = 0; k < m; k++) x[k] = expr; \
+}
+#define FLEP_C_KERNELS(pfx, T, S, m_abs, m_sqrt) \
+FLEP_C_BINARY(pfx##plus, T, +=) \
+FLEP_C_BINARY(pfx##minus, T, -=) \
+FLEP_C_BINARY(pfx##mult, T, *=) \
+FLEP_C_BINARY(pfx##div, T, /=) \
+FLEP_C_UNARY(pfx##neg, T, -x[k]) \
+FLEP_C_UNARY(pfx##abs, T, m_abs(x[k])) \
+FLEP_C_UNARY(pfx##sqrt, T, m_sqrt(x[k])) \
+static void pfx##fill(T* x, T c, int m) { \
+  int k; \
+  for (k = 0; k < m; k++) x[k] = c; \
+} \
+static const struct S pfx##kernels = { \
+  {pfx##plus, pfx##minus, pfx##mult, pfx##div}, \
+  {pfx##neg, pfx##abs, pfx##sqrt}, \
+  pfx##fill};
+FLEP_C_KERNELS(flep_c_, double, FLEPKernels, fabs, sqrt)
+FLEP_C_KERNELS(flep_cf_, float, FLEPKernelsF, FLEP_F(fabs), FLEP_F(sqrt))
+
+#ifdef FLEP_SIMD
+/* One kernel set per instruction set and type: "pfx" names the functions,
+ * "W" is the number of lanes, "V" the vector type, "I" the intrinsic prefix
+ * and "P" its suffix (pd or ps). Lanes left over after the last full vector
+ * are done in plain C.
+ */
+#define FLEP_V_BINARY(pfx, tgt, W, V, I, T, P, name, vop, op) \
+__attribute__((target(tgt))) \
+static void pfx##name(T* y, const T* x, int m) { \
+  int k; \
+  for (k = 0; k + W <= m; k += W) \
+    I##_storeu_##P(y + k, \
+      I##_##vop##_##P(I##_loadu_##P(y + k), I##_loadu_##P(x + k))); \
+  for (; k < m; k++) y[k] op x[k]; \
+}
+#define FLEP_V_UNARY(pfx, tgt, W, V, I, T, P, name, vexpr, expr) \
+__attribute__((target(tgt))) \
+static void pfx##name(T* x, int m) { \
+  int k; \
+  for (k = 0; k + W <= m; k += W) { \
+    V v = I##_loadu_##P(x + k); \
+    I##_storeu_##P(x + k, vexpr); \
+  } \
+  for (; k < m; k++) x[k] = expr; \
+}
+#define FLEP_V_KERNELS(pfx, tgt, W, V, I, T, P, S, NEG, ABS, m_abs, m_sqrt) \
+FLEP_V_BINARY(pfx, tgt, W, V, I, T, P, plus, add, +=) \
+FLEP_V_BINARY(pfx, tgt, W, V, I, T, P, minus, sub, -=) \
+FLEP_V_BINARY(pfx, tgt, W, V, I, T, P, mult, mul, *=) \
+FLEP_V_BINARY(pfx, tgt, W, V, I, T, P, div, div, /=) \
+FLEP_V_UNARY(pfx, tgt, W, V, I, T, P, neg, NEG, -x[k]) \
+FLEP_V_UNARY(pfx, tgt, W, V, I, T, P, abs, ABS, m_abs(x[k])) \
+FLEP_V_UNARY(pfx, tgt, W, V, I, T, P, sqrt, I##_sqrt_##P(v), \
+  m_sqrt(x[k])) \
+__attribute__((target(tgt))) \
+static void pfx##fill(T* x, T c, int m) { \
+  int k; \
+  V v = I##_set1_##P(c); \
+  for (k = 0; k + W <= m; k += W) I##_storeu_##P(x + k, v); \
+  for (; k < m; k++) x[k] = c; \
+} \
+static const struct S pfx##kernels = { \
+  {pfx##plus, pfx##minus, pfx##mult, pfx##div}, \
+  {pfx##neg, pfx##abs, pfx##sqrt}, \
+  pfx##fill};
+
+/* sign flips and clears are bitwise operations on the sign bit */
+FLEP_V_KERNELS(flep_sse2_, "sse2", 2, __m128d, _mm, double, pd, FLEPKernels,
+  _mm_xor_pd(v, _mm_set1_pd(-0.0)),
+  _mm_andnot_pd(_mm_set1_pd(-0.0), v), fabs, sqrt)
+FLEP_V_KERNELS(flep_avx2_, "avx2", 4, __m256d, _mm256, double, pd,
+  FLEPKernels,
+  _mm256_xor_pd(v, _mm256_set1_pd(-0.0)),
+  _mm256_andnot_pd(_mm256_set1_pd(-0.0), v), fabs, sqrt)
+/* AVX-512F has no floating point xor, the DQ extension does */
+FLEP_V_KERNELS(flep_avx512_, "avx512f", 8, __m512d, _mm512, double, pd,
+  FLEPKernels,
+  _mm512_castsi512_pd(_mm512_xor_epi64(_mm512_castpd_si512(v),
+    _mm512_castpd_si512(_mm512_set1_pd(-0.0)))),
+  _mm512_abs_pd(v), fabs, sqrt)
+/* float: twice the lanes */
+FLEP_V_KERNELS(flep_sse2f_, "sse2", 4, __m128, _mm, float, ps, FLEPKernelsF,
+  _mm_xor_ps(v, _mm_set1_ps(-0.0f)),
+  _mm_andnot_ps(_mm_set1_ps(-0.0f), v), FLEP_F(fabs), FLEP_F(sqrt))
+FLEP_V_KERNELS(flep_avx2f_, "avx2", 8, __m256, _mm256, float, ps,
+  FLEPKernelsF,
+  _mm256_xor_ps(v, _mm256_set1_ps(-0.0f)),
+  _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v), FLEP_F(fabs), FLEP_F(sqrt))
+FLEP_V_KERNELS(flep_avx512f_, "avx512f", 16, __m512, _mm512, float, ps,
+  FLEPKernelsF,
+  _mm512_castsi512_ps(_mm512_xor_epi32(_mm512_castps_si512(v),
+    _mm512_castps_si512(_mm512_set1_ps(-0.0f)))),
+  _mm512_abs_ps(v), FLEP_F(fabs), FLEP_F(sqrt))
+#endif
+
+/* widest kernel set supported by the running CPU (looked up on each call,
+ * which is cheap, rather than cached where threads would race for it)
+ */
+static const struct FLEPKernels* flep_kernels(void) {
+#ifdef FLEP_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return &flep_avx512_kernels;
+  if (__builtin_cpu_supports("avx2")) return &flep_avx2_kernels;
+  if (__builtin_cpu_supports("sse2")) return &flep_sse2_kernels;
+  return &flep_c_kernels;
+#else
+  return &flep_c_kernels;
+#endif
+}
+
+static const struct FLEPKernelsF* flep_kernelsf(void) {
+#ifdef FLEP_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return &flep_avx512f_kernels;
+  if (__builtin_cpu_supports("avx2")) return &flep_avx2f_kernels;
+  if (__builtin_cpu_supports("sse2")) return &flep_sse2f_kernels;
+  return &flep_cf_kernels;
+#else
+  return &flep_cf_kernels;
+#endif
+}
+
+/* same as "flep_eval", but one opcode at a time over blocks of rows, read
+ * from "cols" or, for expressions bound by "flep_bind", from "rec"; over
+ * values of type "T" with the kernels returned by "kernels" and the math
+ * functions (of struct "M") returned by "math"
+ */
+#define FLEP_BLOCK 64
+#define FLEP_BATCH(name, T, S, kernels, M, math) \
+static void name(const struct FLEP* f, const T* const* cols, \
+  const char* rec, size_t n, T* out) { \
+  const struct S* kv = kernels(); \
+  const struct M* mv = math(f); \
+  const int* text = FLEP_TEXT(f); \
+  T frame[FLEP_FRAME][FLEP_BLOCK], (*stack)[FLEP_BLOCK] = frame; \
+  size_t row; \
+  if (f->depth + f->ntemp > FLEP_FRAME) { \
+    stack = (T(*)[FLEP_BLOCK])malloc((f->depth + f->ntemp) \
+      * sizeof(*stack)); \
+    if (!stack) { \
+      FLEP_FILL_NAN(T, f, n, out) \
+      return; \
+    } \
+  } \
+  for (row = 0; row < n; row += FLEP_BLOCK) { \
+    int ip, sp = -1, k; \
+    int m = (n - row < FLEP_BLOCK) ? (int)(n - row) : FLEP_BLOCK; \
+    for (ip = 0;; ip++) { \
+      /* top and second-to-top block of the stack (when they exist) */ \
+      T *x = stack[sp > 0 ? sp : 0], *y = stack[sp > 1 ? sp-1 : 0]; \
+      int op = FLEP_OPCODE(text[ip]), idx = FLEP_OPPARM(text[ip]); \
+      switch (op) { \
+	case FLEP_UNARY_MINUS: kv->unary[0](x, m); continue; \
+	case FLEP_PLUS: case FLEP_MINUS: case FLEP_MULT: case FLEP_DIV: \
+	  /* Order is critical - search for "FLEPCodeDep" for related data */ \
+	  kv->binary[op - FLEP_PLUS](y, x, m); --sp; continue; \
+	case FLEP_POWER: mv->pow(y, x, m); --sp; continue; \
+	case FLEP_VAR: \
+	  if (rec) { \
+	    const char* p = rec + row * f->stride; \
+	    x = stack[++sp]; \
+	    for (k = 0; k < m; k++, p += f->stride) { \
+	      x[k] = ((const T*)p)[idx]; \
+	    } \
+	  } else { \
+	    memcpy(stack[++sp], cols[idx] + row, m * sizeof(T)); \
+	  } \
+	  continue; \
+	case FLEP_CONST: \
+	  kv->fill(stack[++sp], (T)FLEP_DATA(f)[idx], m); continue; \
+	case FLEP_SIN: case FLEP_COS: case FLEP_TAN: case FLEP_EXP: \
+	case FLEP_LOG: mv->unary(x, m, op); continue; \
+	case FLEP_ABS: kv->unary[1](x, m); continue; \
+	case FLEP_SQRT: kv->unary[2](x, m); continue; \
+	case FLEP_STORE: \
+	  memcpy(stack[f->depth + idx], x, m * sizeof(T)); continue; \
+	case FLEP_LOAD: \
+	  memcpy(stack[++sp], stack[f->depth + idx], m * sizeof(T)); \
+	  continue; \
+	case FLEP_SINCOS: \
+	  y = stack[f->depth + (idx >> 1)]; \
+	  if (idx & 1) mv->sincos(x, y, x, m); \
+	  else mv->sincos(x, x, y, m); \
+	  continue; \
+	case FLEP_OUTPUT: \
+	  /* one column of "n" rows per output */ \
+	  memcpy(out + (size_t)idx * n + row, x, m * sizeof(T)); \
+	  --sp; continue; \
+	case FLEP_END: break; \
+      } \
+      break; \
+    } \
+    if (!f->nout) memcpy(out + row, stack[0], m * sizeof(T)); \
+  } \
+  if (stack != frame) free(stack); \
+}
+FLEP_BATCH(flep_batch, double, FLEPKernels, flep_kernels, FLEPMath,
+  flep_math)
+FLEP_BATCH(flep_batchf, float, FLEPKernelsF, flep_kernelsf, FLEPMathF,
+  flep_mathf)
+
+void flep_eval_batch(const struct FLEP* f, const double* const cols[7],
+  size_t n, double* out) {
+  if (f->stride) { /* word offsets, which are not columns */
+    FLEP_FILL_NAN(double, f, n, out)
+    return;
+  }
+  FLEP_PROFILE_BATCH(f, n, flep_batch(f, cols, 0, n, out));
+}
+
+void flep_eval_batchf(const struct FLEP* f, const float* const cols[7],
+  size_t n, float* out) {
+  if (f->stride) {
+    FLEP_FILL_NAN(float, f, n, out)
+    return;
+  }
+  FLEP_PROFILE_BATCH(f, n, flep_batchf(f, cols, 0, n, out));
+}
+
+void flep_eval_records(const struct FLEP* f, const void* records, size_t n,
+  double* out) {
+  if (!f->stride) { /* every record would be read as the first */
+    FLEP_FILL_NAN(double, f, n, out)
+    return;
+  }
+  FLEP_PROFILE_BATCH(f, n, flep_batch(f, 0, (const char*)records, n, out));
+}
+
+/* x86-64 JIT: translates opcodes into scalar SSE2 code. Stack slot "i" lives
+ * in register xmm"i", so expressions needing more than 16 slots are left to
+ * the interpreter. Transcendentals are calls into libm, around which the
+ * slots below the arguments are spilled to the native stack. Constants and
+ * sign masks are kept in a pool after the code.
+ * Define FLEP_NO_JIT to leave it out.
+ */
+#if defined(__x86_64__) && defined(__unix__) && !defined(FLEP_NO_JIT)
+#define FLEP_JIT
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define FLEP_JIT_HEADER 16 /* bytes before the code: size of the mapping */
+#define FLEP_JIT_MAXOP 400 /* upper bound of bytes emitted per opcode */
+#define FLEP_RSP 4
+#define FLEP_RBX 3
+#define FLEP_RSI 6
+
+/* code being emitted, and where it needs addresses of the pool patched in */
+struct FLEPAsm {
+  unsigned char* code;
+  int n;
+  int *fix_at, *fix_to, nfix;
+};
+
+static void flep_asm_byte(struct FLEPAsm* a, int b) {
+  a->code[a->n++] = (unsigned char)b;
+}
+
+static void flep_asm_int(struct FLEPAsm* a, long v) {
+  int i;
+  for (i = 0; i < 4; i++) flep_asm_byte(a, (int)(v >> 8*i) & 0xff);
+}
+
+/* prefix, REX (if any register above xmm7), 0F and the opcode */
+static void flep_asm_op(struct FLEPAsm* a, int pfx, int op, int r, int m) {
+  flep_asm_byte(a, pfx);
+  if (r > 7 || m > 7) flep_asm_byte(a, 0x40 | (r > 7) << 2 | (m > 7));
+  flep_asm_byte(a, 0x0f);
+  flep_asm_byte(a, op);
+}
+
+/* "op xmm_r, xmm_m" */
+static void flep_asm_rr(struct FLEPAsm* a, int pfx, int op, int r, int m) {
+  flep_asm_op(a, pfx, op, r, m);
+  flep_asm_byte(a, 0xc0 | (r & 7) << 3 | (m & 7));
+}
+
+/* "op xmm_r, [base + disp]" */
+static void flep_asm_rm(struct FLEPAsm* a, int pfx, int op, int r, int base,
+  int disp) {
+  flep_asm_op(a, pfx, op, r, 0);
+  flep_asm_byte(a, 0x80 | (r & 7) << 3 | base);
+  if (base == FLEP_RSP) flep_asm_byte(a, 0x24);
+  flep_asm_int(a, disp);
+}
+
+/* "op xmm_r, [rip + ...]" addressing byte "off" of the pool */
+static void flep_asm_rp(struct FLEPAsm* a, int pfx, int op, int r, int off) {
+  flep_asm_op(a, pfx, op, r, 0);
+  flep_asm_byte(a, 0x05 | (r & 7) << 3);
+  a->fix_at[a->nfix] = a->n;
+  a->fix_to[a->nfix++] = off;
+  flep_asm_int(a, 0);
+}
+
+/* "mov rax, fn; call rax", "pfn" points to the function pointer "fn" */
+static void flep_asm_call(struct FLEPAsm* a, const void* pfn) {
+  unsigned char p[sizeof(FLEPFunc)];
+  unsigned i;
+  memcpy(p, pfn, sizeof(p));
+  flep_asm_byte(a, 0x48);
+  flep_asm_byte(a, 0xb8);
+  for (i = 0; i < sizeof(p); i++) flep_asm_byte(a, p[i]);
+  flep_asm_byte(a, 0xff);
+  flep_asm_byte(a, 0xd0);
+}
+
+#define FLEP_MOVSD_LOAD 0xf2, 0x10
+#define FLEP_MOVSD_STORE 0xf2, 0x11
+#define FLEP_MOVAPD 0x66, 0x28
+/* pool layout: sign mask, abs mask (16 bytes each), then "f->data" */
+#define FLEP_POOL_SIGN 0
+#define FLEP_POOL_ABS 16
+#define FLEP_POOL_DATA 32
+
+/* call unary ("n" == 1) or binary libm function on the slots ending at "t" */
+static void flep_asm_libm(struct FLEPAsm* a, const void* pfn, int n, int t) {
+  int i, r = t - n + 1; /* slot of the first argument and of the result */
+  for (i = 0; i < r; i++) flep_asm_rm(a, FLEP_MOVSD_STORE, i, FLEP_RSP, 8*i);
+  for (i = 0; i < n; i++) {
+    if (r + i != i) flep_asm_rr(a, FLEP_MOVAPD, i, r + i);
+  }
+  flep_asm_call(a, pfn);
+  if (r) flep_asm_rr(a, FLEP_MOVAPD, r, 0);
+  for (i = 0; i < r; i++) flep_asm_rm(a, FLEP_MOVSD_LOAD, i, FLEP_RSP, 8*i);
+}
+
+/* "lea reg, [rsp + disp]" */
+static void flep_asm_lea(struct FLEPAsm* a, int reg, int disp) {
+  flep_asm_byte(a, 0x48);
+  flep_asm_byte(a, 0x8d);
+  flep_asm_byte(a, 0x84 | reg << 3);
+  flep_asm_byte(a, 0x24);
+  flep_asm_int(a, disp);
+}
+
+/* "flep_sincos" of slot "t", sine to [rsp + s] and cosine to [rsp + c] */
+static void flep_asm_sincos(struct FLEPAsm* a, const void* pfn, int t, int s,
+  int c) {
+  int i;
+  for (i = 0; i < t; i++) flep_asm_rm(a, FLEP_MOVSD_STORE, i, FLEP_RSP, 8*i);
+  if (t) flep_asm_rr(a, FLEP_MOVAPD, 0, t);
+  flep_asm_lea(a, 7, s); /* rdi */
+  flep_asm_lea(a, FLEP_RSI, c);
+  flep_asm_call(a, pfn);
+  for (i = 0; i < t; i++) flep_asm_rm(a, FLEP_MOVSD_LOAD, i, FLEP_RSP, 8*i);
+  flep_asm_rm(a, FLEP_MOVSD_LOAD, t, FLEP_RSP, 8*t);
+}
+#endif
+
+FLEPFunc flep_jit(const struct FLEP* f) {
+#ifdef FLEP_JIT
+  static double (*const libm[2][5])(double) = {
+    {sin, cos, tan, exp, log},
+    {flep_m_sin, flep_m_cos, flep_m_tan, flep_m_exp, flep_m_log}};
+  static double (*const power[2])(double, double) = {pow, flep_m_pow};
+  static void (*const sincos2[2])(double, double*, double*) = {
+    flep_sincos, flep_m_sincos};
+  int own = (f->flags & FLEP_APPROX) != 0;
+  int ip, sp = -1, calls = (f->ntemp > 0), frame, val;
+  int depth = f->depth;
+  const int* text = FLEP_TEXT(f);
+  size_t size;
+  struct FLEPAsm a;
+  unsigned char *page, *pool;
+  FLEPFunc fn;
+  if (depth > 16 || f->nout) return flep_eval;
+  for (ip = 0; text[ip] != FLEP_END; ip++) {
+    int op = FLEP_OPCODE(text[ip]);
+    if ((op >= FLEP_SIN && op <= FLEP_LOG) || op == FLEP_POWER ||
+        op == FLEP_SINCOS) calls = 1;
+  }
+  size = FLEP_JIT_HEADER + (size_t)(ip + 1) * FLEP_JIT_MAXOP
+    + FLEP_POOL_DATA + (size_t)f->nd * sizeof(double) + 16;
+  page = (unsigned char*)mmap(0, size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (page == (unsigned char*)MAP_FAILED) return flep_eval;
+  memcpy(page, &size, sizeof(size));
+  a.code = page + FLEP_JIT_HEADER;
+  a.n = a.nfix = 0;
+  a.fix_at = (int*)malloc((ip + 1) * 2 * sizeof(int));
+  a.fix_to = a.fix_at + ip + 1;
+  frame = (8 * (depth + f->ntemp) + 15) & ~15;
+  val = FLEP_RSI;
+  if (calls) {
+    /* rbx keeps "val" across calls; "frame" keeps the stack aligned and
+     * holds spilled slots followed by temporaries */
+    flep_asm_byte(&a, 0x53); /* push rbx */
+    flep_asm_byte(&a, 0x48); /* mov rbx, rsi */
+    flep_asm_byte(&a, 0x89);
+    flep_asm_byte(&a, 0xf3);
+    flep_asm_byte(&a, 0x48); /* sub rsp, frame */
+    flep_asm_byte(&a, 0x81);
+    flep_asm_byte(&a, 0xec);
+    flep_asm_int(&a, frame);
+    val = FLEP_RBX;
+  }
+  for (ip = 0; text[ip] != FLEP_END; ip++) {
+    int op = FLEP_OPCODE(text[ip]), idx = FLEP_OPPARM(text[ip]);
+    switch (op) {
+      case FLEP_UNARY_MINUS:
+	flep_asm_rp(&a, 0x66, 0x57, sp, FLEP_POOL_SIGN); break; /* xorpd */
+      case FLEP_PLUS: flep_asm_rr(&a, 0xf2, 0x58, sp-1, sp); sp--; break;
+      case FLEP_MINUS: flep_asm_rr(&a, 0xf2, 0x5c, sp-1, sp); sp--; break;
+      case FLEP_MULT: flep_asm_rr(&a, 0xf2, 0x59, sp-1, sp); sp--; break;
+      case FLEP_DIV: flep_asm_rr(&a, 0xf2, 0x5e, sp-1, sp); sp--; break;
+      case FLEP_POWER: flep_asm_libm(&a, &power[own], 2, sp); sp--; break;
+      case FLEP_VAR:
+	flep_asm_rm(&a, FLEP_MOVSD_LOAD, ++sp, val, 8*idx); break;
+      case FLEP_CONST:
+	flep_asm_rp(&a, FLEP_MOVSD_LOAD, ++sp, FLEP_POOL_DATA + 8*idx); break;
+      case FLEP_SIN: case FLEP_COS: case FLEP_TAN: case FLEP_EXP:
+      case FLEP_LOG:
+	/* Order is critical - search for "FLEPCodeDep" to see related data */
+	flep_asm_libm(&a, &libm[own][op - FLEP_SIN], 1, sp); break;
+      case FLEP_ABS:
+	flep_asm_rp(&a, 0x66, 0x54, sp, FLEP_POOL_ABS); break; /* andpd */
+      case FLEP_SQRT: flep_asm_rr(&a, 0xf2, 0x51, sp, sp); break;
+      case FLEP_STORE:
+	flep_asm_rm(&a, FLEP_MOVSD_STORE, sp, FLEP_RSP, 8*(depth + idx));
+	break;
+      case FLEP_LOAD:
+	flep_asm_rm(&a, FLEP_MOVSD_LOAD, ++sp, FLEP_RSP, 8*(depth + idx));
+	break;
+      case FLEP_SINCOS:
+	if (idx & 1) {
+	  flep_asm_sincos(&a, &sincos2[own], sp, 8*(depth + (idx >> 1)), 8*sp);
+	} else {
+	  flep_asm_sincos(&a, &sincos2[own], sp, 8*sp, 8*(depth + (idx >> 1)));
+	}
+	break;
+    }
+  }
+  if (calls) {
+    flep_asm_byte(&a, 0x48); /* add rsp, frame */
+    flep_asm_byte(&a, 0x81);
+    flep_asm_byte(&a, 0xc4);
+    flep_asm_int(&a, frame);
+    flep_asm_byte(&a, 0x5b); /* pop rbx */
+  }
+  flep_asm_byte(&a, 0xc3); /* ret */
+  /* lay out the pool at the next 16-byte boundary and patch references */
+  pool = page + ((FLEP_JIT_HEADER + a.n + 15) & ~15);
+  {
+    unsigned char sign[8] = {0, 0, 0, 0, 0, 0, 0, 0x80};
+    unsigned char abs[8] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x7f};
+    memcpy(pool + FLEP_POOL_SIGN, sign, 8);
+    memcpy(pool + FLEP_POOL_SIGN + 8, sign, 8);
+    memcpy(pool + FLEP_POOL_ABS, abs, 8);
+    memcpy(pool + FLEP_POOL_ABS + 8, abs, 8);
+    memcpy(pool + FLEP_POOL_DATA, FLEP_DATA(f), f->nd * sizeof(double));
+  }
+  while (a.nfix--) {
+    int at = a.fix_at[a.nfix];
+    unsigned char* p = a.code + at;
+    int n = a.n;
+    a.n = at;
+    flep_asm_int(&a, (long)(pool + a.fix_to[a.nfix] - (p + 4)));
+    a.n = n;
+  }
+  free(a.fix_at);
+  if (mprotect(page, size, PROT_READ | PROT_EXEC)) {
+    munmap(page, size);
+    return flep_eval;
+  }
+  page += FLEP_JIT_HEADER;
+  memcpy(&fn, &page, sizeof(fn));
+  return fn;
+#else
+  (void)f;
+  return flep_eval;
+#endif
+}
+
+void flep_jit_free(FLEPFunc fn) {
+#ifdef FLEP_JIT
+  unsigned char* page;
+  size_t size;
+  if (fn == flep_eval) return;
+  memcpy(&page, &fn, sizeof(page));
+  page -= FLEP_JIT_HEADER;
+  memcpy(&size, page, sizeof(size));
+  munmap(page, size);
+#else
+  (void)fn;
+#endif
+}
+
+/* C code generation: the opcodes of "f" as statements, stack slots and
+ * temporaries being locals "s"i and "t"i, computing exactly what the
+ * interpreter does. Functions follow one another in a file, after the
+ * preamble written once by "flep_emit_c_header".
+ */
+static const char* flep_emit_preamble[] = {
+  "/* Emitted by flep_emit_c: results are those of flep_eval bit for bit,",
+  " * unless compiled with -ffast-math or the like. Contraction of products",
+  " * and sums, which rounds them once, is turned off where possible.",
+  " */",
+  "#include <math.h>",
+  "#include <stddef.h>",
+  "#if defined(__clang__)",
+  "#pragma STDC FP_CONTRACT OFF",
+  "#elif defined(__GNUC__)",
+  "#pragma GCC optimize (\"fp-contract=off\")",
+  "#endif",
+  0};
+
+/* "x" as a C literal of the same value, whatever the locale */
+static void flep_emit_double(FILE* file, double x) {
+  char buf[32], *s;
+  if (x != x) {
+    fputs("(HUGE_VAL - HUGE_VAL)", file);
+    return;
+  }
+  if (x == HUGE_VAL || x == -HUGE_VAL) {
+    fputs(x < 0 ? "-HUGE_VAL" : "HUGE_VAL", file);
+    return;
+  }
+  sprintf(buf, "%.17g", x);
+  for (s = buf; *s; s++) {
+    if (!(*s >= '0' && *s <= '9') && *s != '-' && *s != '+' && *s != 'e') {
+      *s = '.';
+    }
+  }
+  if (!strpbrk(buf, ".e")) strcat(buf, ".0"); /* a double, even -0.0 */
+  fputs(buf, file);
+}
+
+/* statements computing "f": for one row of "val" (which is "cols" if
+ * "batch" is 1, and per record if 2) into "out", or returned
+ */
+static void flep_emit_body(const struct FLEP* f, FILE* file, int batch) {
+  static const char* fn[] = {"sin", "cos", "tan", "exp", "log", "fabs",
+    "sqrt"};
+  const int* text = FLEP_TEXT(f);
+  const char* in = batch ? "    " : "  ";
+  char* read = (char*)calloc(f->ntemp + 1, 1); /* temporaries ever read */
+  int ip, i, sp = -1;
+  for (ip = 0; FLEP_OPCODE(text[ip]) != FLEP_END; ip++) {
+    if (FLEP_OPCODE(text[ip]) == FLEP_LOAD) read[FLEP_OPPARM(text[ip])] = 1;
+    if (FLEP_OPCODE(text[ip]) == FLEP_SINCOS) {
+      read[FLEP_OPPARM(text[ip]) >> 1] = 1;
+    }
+  }
+  fprintf(file, "%sdouble s0", in);
+  for (i = 1; i < f->depth; i++) fprintf(file, ", s%d", i);
+  for (i = 0; i < f->ntemp; i++) if (read[i]) fprintf(file, ", t%d", i);
+  fprintf(file, ";\n");
+  if (batch == 2 && f->vars) {
+    fprintf(file, "%sconst double* val = (const double*)((const char*)"
+      "records + i * %d);\n", in, f->stride);
+  }
+  if (!f->vars) {
+    fprintf(file, "%s(void)%s;\n", in,
+      batch == 2 ? "records" : batch ? "cols" : "val");
+  }
+  for (ip = 0; FLEP_OPCODE(text[ip]) != FLEP_END; ip++) {
+    int op = FLEP_OPCODE(text[ip]), k = FLEP_OPPARM(text[ip]);
+    if (op == FLEP_STORE && !read[k]) continue; /* fused into a SINCOS */
+    fputs(in, file);
+    switch (op) {
+      case FLEP_UNARY_MINUS:
+	fprintf(file, "s%d = -s%d;\n", sp, sp);
+	break;
+      case FLEP_PLUS: case FLEP_MINUS: case FLEP_MULT: case FLEP_DIV:
+	sp--;
+	fprintf(file, "s%d = s%d %c s%d;\n", sp, sp, "+-*/"[op - FLEP_PLUS],
+	  sp + 1);
+	break;
+      case FLEP_POWER:
+	sp--;
+	fprintf(file, "s%d = pow(s%d, s%d);\n", sp, sp, sp + 1);
+	break;
+      case FLEP_VAR:
+	sp++;
+	fprintf(file, batch == 1 ? "s%d = cols[%d][i];\n" :
+	  "s%d = val[%d];\n", sp, k);
+	break;
+      case FLEP_CONST:
+	sp++;
+	fprintf(file, "s%d = ", sp);
+	flep_emit_double(file, FLEP_DATA(f)[k]);
+	fprintf(file, ";\n");
+	break;
+      case FLEP_STORE:
+	fprintf(file, "t%d = s%d;\n", k, sp);
+	break;
+      case FLEP_LOAD:
+	sp++;
+	fprintf(file, "s%d = t%d;\n", sp, k);
+	break;
+      case FLEP_SINCOS: /* as two calls, giving what "sincos" gives */
+	fprintf(file, "t%d = %s(s%d);\n%ss%d = %s(s%d);\n", k >> 1,
+	  k & 1 ? "sin" : "cos", sp, in, sp, k & 1 ? "cos" : "sin", sp);
+	break;
+      case FLEP_OUTPUT:
+	fprintf(file, batch ? "out[%d * n + i] = s%d;\n" :
+	  "out[%d] = s%d;\n", k, sp);
+	sp--;
+	break;
+      default:
+	fprintf(file, "s%d = %s(s%d);\n", sp, fn[op - FLEP_SIN], sp);
+    }
+  }
+  if (!f->nout) fprintf(file, batch ? "%sout[i] = s0;\n" :
+    "%sreturn s0;\n", in);
+  free(read);
+}
+
+int flep_emit_c_header(FILE* file) {
+  int i;
+  for (i = 0; flep_emit_preamble[i]; i++) {
+    fprintf(file, "%s\n", flep_emit_preamble[i]);
+  }
+  return !ferror(file);
+}
+
+int flep_emit_c(const struct FLEP* f, const char* name, FILE* file) {
+  if (f->flags & FLEP_APPROX) return 0; /* functions only FLEP has */
+  fprintf(file, f->nout ? "\nvoid %s(const double* val, double* out) {\n" :
+    "\ndouble %s(const double* val) {\n", name);
+  flep_emit_body(f, file, 0);
+  fprintf(file, "}\n\n");
+  return !ferror(file);
+}
+
+int flep_emit_c_batch(const struct FLEP* f, const char* name, FILE* file) {
+  if (f->flags & FLEP_APPROX) return 0;
+  fprintf(file, f->stride ?
+    "\nvoid %s(const void* records, size_t n, double* out) {\n" :
+    "\nvoid %s(const double* const cols[7], size_t n, double* out) {\n",
+    name);
+  fprintf(file, "  size_t i;\n  for (i = 0; i < n; i++) {\n");
+  flep_emit_body(f, file, f->stride ? 2 : 1);
+  fprintf(file, "  }\n}\n\n");
+  return !ferror(file);
+}
+
+/* ... */
+void flep_free(const struct FLEP* f) {
+#ifdef FLEP_PROFILE
+  if (f && flep_prof_nbucket) {
+    struct FLEPProfile *p, **at;
+    pthread_mutex_lock(&flep_prof_lock);
+    at = flep_prof_bucket + FLEP_PROF_HASH(f) % flep_prof_nbucket;
+    while ((p = *at) && p->f != f) at = &p->next;
+    if (p) {
+      *at = p->next;
+      flep_prof_n--;
+      free(p->text);
+      free(p->ticks);
+      free(p);
+    }
+    pthread_mutex_unlock(&flep_prof_lock);
+  }
+#endif
+  if (f && f->heap) {
+    free((void*)f);
+  }
+}
+
+size_t flep_memory(const struct FLEP* f) {
+  return f->size;
+}
+
+int flep_outputs(const struct FLEP* f) {
+  return f->nout ? f->nout : 1;
+}
+
+int flep_variables(const struct FLEP* f) {
+  return f->vars;
+}
+
+size_t flep_stride(const struct FLEP* f) {
+  return (size_t)f->stride;
+}
+
+size_t flep_serialize(const struct FLEP* f, void* buf, size_t size) {
+  if (buf && size >= (size_t)f->size) {
+    memcpy(buf, f, f->size);
+    ((struct FLEP*)buf)->heap = 0;
+  }
+  return f->size;
+}
+
+/* Which of the "d", "a" and "b" operands of an instruction are stack slots,
+ * variables, constants or outputs ('S', 'V', 'C', 'O', or 0 if unused).
+ * Returns 0 for unknown instructions.
+ */
+static int flep_kinds(int op, int* d, int* a, int* b) {
+  *d = 0; *a = 'S'; *b = 0;
+  if (op >= FLEP_I_PLUS_RV && op < FLEP_I_MULTPLUS_RC) {
+    static const char* kinds = "RV" "RC" "VV" "VC" "CV";
+    int kind = (op - FLEP_I_PLUS_RV) % 5;
+    *a = kinds[2 * kind];
+    *b = kinds[2 * kind + 1];
+    *d = (*a == 'R') ? 0 : 'S';
+    if (*a == 'R') *a = 0;
+    return 1;
+  }
+  switch (op) {
+    case FLEP_I_PLUS: case FLEP_I_MINUS: case FLEP_I_MULT:
+    case FLEP_I_DIV: case FLEP_I_POWER: case FLEP_I_STORE:
+    case FLEP_I_SINCOS: case FLEP_I_COSSIN: break;
+    case FLEP_I_VAR: *d = 'S'; *a = 'V'; break;
+    case FLEP_I_CONST: *d = 'S'; *a = 'C'; break;
+    case FLEP_I_LOAD: *d = 'S'; break;
+    case FLEP_I_OUTPUT: *a = 'O'; break;
+    case FLEP_I_MULTPLUS_RC: *b = 'C'; break;
+    case FLEP_I_END: case FLEP_I_UNARY_MINUS: case FLEP_I_SIN:
+    case FLEP_I_COS: case FLEP_I_TAN: case FLEP_I_EXP: case FLEP_I_LOG:
+    case FLEP_I_ABS: case FLEP_I_SQRT: *a = 0; break;
+    default: return 0;
+  }
+  return 1;
+}
+
+/* Whether the opcodes and instructions of "f" stay within its constants,
+ * stack and temporaries, so that a corrupt image cannot be run
+ */
+static int flep_check(const struct FLEP* f) {
+  const int* text = FLEP_TEXT(f);
+  const struct FLEPInsn* c = FLEP_CODE(f);
+  int i, sp = 0, depth = 0, slots = f->depth + f->ntemp;
+  int nvar = f->stride ? f->stride / (int)sizeof(double) : 7;
+  if (slots < 1) slots = 1;
+  if (f->nt < 1 || text[f->nt - 1] != FLEP_END) return 0;
+  if (f->nc < 1 || c[f->nc - 1].op != FLEP_I_END) return 0;
+  for (i = 0; i < f->nt - 1; i++) {
+    int op = FLEP_OPCODE(text[i]), parm = FLEP_OPPARM(text[i]);
+    switch (op) {
+      case FLEP_VAR: if (parm < 0 || parm >= nvar) return 0; sp++; break;
+      case FLEP_CONST: if (parm < 0 || parm >= f->nd) return 0; sp++; break;
+      case FLEP_LOAD: if (parm < 0 || parm >= f->ntemp) return 0; sp++; break;
+      case FLEP_STORE: if (parm < 0 || parm >= f->ntemp) return 0; break;
+      case FLEP_SINCOS:
+	if (parm < 0 || (parm >> 1) >= f->ntemp) return 0;
+	break;
+      case FLEP_PLUS: case FLEP_MINUS: case FLEP_MULT: case FLEP_DIV:
+      case FLEP_POWER: sp--; break;
+      case FLEP_OUTPUT:
+	if (parm < 0 || parm >= f->nout || sp < 1) return 0;
+	sp--;
+	continue;
+      case FLEP_UNARY_MINUS: case FLEP_SIN: case FLEP_COS: case FLEP_TAN:
+      case FLEP_EXP: case FLEP_LOG: case FLEP_ABS: case FLEP_SQRT: break;
+      default: return 0;
+    }
+    if (sp < 1) return 0;
+    if (sp > depth) depth = sp;
+  }
+  if (sp != !f->nout || depth != f->depth || f->ntemp > f->nt) return 0;
+  for (i = 0; i < f->nc; i++, c++) {
+    int d, a, b;
+    if (!flep_kinds(c->op, &d, &a, &b)) return 0;
+#define FLEP_CHECK(k, v) if ((k) && ((v) < 0 || (v) >= ((k) == 'S' ? \
+  slots : (k) == 'V' ? nvar : (k) == 'O' ? f->nout : f->nd))) return 0;
+    FLEP_CHECK(d, c->d)
+    FLEP_CHECK(a, c->a)
+    FLEP_CHECK(b, c->b)
+#undef FLEP_CHECK
+  }
+  return 1;
+}
+
+const struct FLEP* flep_load(const void* image, size_t size, size_t* used) {
+  const struct FLEP* f = (const struct FLEP*)image;
+  size_t left; /* bytes of the block after the parts checked so far */
+  if (size < sizeof(struct FLEP) || ((size_t)image & 7) ||
+      memcmp(f->magic, FLEP_MAGIC, 4) || f->version != FLEP_VERSION ||
+      f->order != FLEP_ORDER || f->heap || f->size < 0 ||
+      (size_t)f->size > size || (size_t)f->size < sizeof(struct FLEP) ||
+      f->nd < 0 || f->nc < 0 || f->nt < 0 || f->depth < 0 ||
+      f->ntemp < 0 || f->nout < 0) {
+    return 0;
+  }
+  /* part by part, so that no sum of the counts can wrap around */
+  left = (size_t)f->size - sizeof(struct FLEP);
+  if ((size_t)f->nd > left / sizeof(double)) return 0;
+  left -= (size_t)f->nd * sizeof(double);
+  if ((size_t)f->nc > left / sizeof(struct FLEPInsn)) return 0;
+  left -= (size_t)f->nc * sizeof(struct FLEPInsn);
+  if ((size_t)f->nt > left / sizeof(int) ||
+      left != ((size_t)f->nt * sizeof(int) + 7) / 8 * 8 ||
+      (f->vars & ~127) || f->stride < 0 || f->stride % sizeof(double) ||
+      !flep_check(f)) {
+    return 0;
+  }
+  if (used) *used = f->size;
+  return f;
+}
+
+/* Copy of "f" whose variables are read "stride" bytes apart: the index of
+ * each variable in opcodes and instructions becomes that of its field in
+ * a record seen as an array of doubles.
+ */
+const struct FLEP* flep_bind(const struct FLEP* f,
+  const struct FLEPLayout* layout) {
+  struct FLEP* g;
+  struct FLEPInsn* c;
+  int* text;
+  int i, word[7];
+  const size_t w = sizeof(double);
+  if (f->stride || !layout->stride || layout->stride % w ||
+      layout->stride > (size_t)FLEP_OPPARM(INT_MAX) * w) {
+    return 0;
+  }
+  for (i = 0; i < 7; i++) {
+    if (!(f->vars >> i & 1)) continue;
+    if (layout->offset[i] % w || layout->offset[i] + w > layout->stride) {
+      return 0;
+    }
+    word[i] = (int)(layout->offset[i] / w);
+  }
+  g = (struct FLEP*)malloc(f->size);
+  if (!g) return 0;
+  memcpy(g, f, f->size);
+  g->heap = 1;
+  g->stride = (int)layout->stride;
+  text = (int*)FLEP_TEXT(g);
+  for (i = 0; i < g->nt; i++) {
+    if (FLEP_OPCODE(text[i]) == FLEP_VAR) {
+      text[i] = FLEP_BITFUSE(FLEP_VAR, word[FLEP_OPPARM(text[i])]);
+    }
+  }
+  for (i = 0, c = (struct FLEPInsn*)FLEP_CODE(g); i < g->nc; i++, c++) {
+    int d, a, b;
+    flep_kinds(c->op, &d, &a, &b);
+    if (a == 'V') c->a = word[c->a];
+    if (b == 'V') c->b = word[c->b];
+  }
+  return g;
+}
+
+/* published pretty printer for compiled expression */
+/* print opcode "i" of "f", without a newline */
+static void flep_dump_opcode(const struct FLEP* f, int i) {
+  int op = FLEP_TEXT(f)[i];
+  switch(FLEP_OPCODE(op)) {
+    case FLEP_CONST:
+      printf("%d: %s (%12.6f)", i, dbg_strings[FLEP_CONST], 
+	FLEP_DATA(f)[FLEP_OPPARM(op)]);
+      break;
+    case FLEP_VAR: case FLEP_STORE: case FLEP_LOAD: case FLEP_SINCOS:
+    case FLEP_OUTPUT:
+      printf("%d: %s (%d)", i, dbg_strings[FLEP_OPCODE(op)],
+	FLEP_OPPARM(op));
+      break;
+    default:
+      printf("%d: %s", i, dbg_strings[op]);
+  }
+}
+
+void flep_dump(const struct FLEP* f) {
+  int i;
+  printf("\n");
+  for (i = 0; i < f->nt; i++) {
+    flep_dump_opcode(f, i);
+    printf("\n");
+  }
+  printf("%d instructions:\n", f->nc);
+  for (i = 0; i < f->nc; i++) {
+    const struct FLEPInsn* c = FLEP_CODE(f) + i;
+    printf("%d: %s (%d, %d, %d)\n", i, flep_insn_names[c->op],
+      c->d, c->a, c->b);
+  }
+}
+
+/* Statistics of FLEP_PROFILE: ticks of scalar evaluations are estimated
+ * from those timed, as their mean times the number of calls
+ */
+#ifdef FLEP_PROFILE
+static double flep_profile_ticks(const struct FLEPProfile* p, int i) {
+  return p->samples ? p->ticks[i] / p->samples * p->calls : 0;
+}
+
+int flep_stats(const struct FLEP* f, struct FLEPStats* s) {
+  struct FLEPProfile* p;
+  int i;
+  memset(s, 0, sizeof(*s));
+  pthread_mutex_lock(&flep_prof_lock);
+  p = flep_profile_of(f, 0);
+  if (p) {
+    s->calls = p->calls;
+    s->rows = p->rows;
+    s->samples = p->samples;
+    for (i = 0; i < p->nt; i++) s->ticks += flep_profile_ticks(p, i);
+    s->batch_ticks = p->batch_ticks;
+  }
+  pthread_mutex_unlock(&flep_prof_lock);
+  return p != 0;
+}
+
+static int flep_compare_ops(const void* x, const void* y) {
+  double u = ((const struct FLEPOpStats*)x)->ticks;
+  double v = ((const struct FLEPOpStats*)y)->ticks;
+  return (u < v) - (u > v);
+}
+
+int flep_stats_opcodes(struct FLEPOpStats* s, int n) {
+  struct FLEPOpStats all[FLEP_OUTPUT + 1];
+  struct FLEPProfile* p;
+  size_t b;
+  int i, m = 0;
+  memset(all, 0, sizeof(all));
+  pthread_mutex_lock(&flep_prof_lock);
+  for (b = 0; b < flep_prof_nbucket; b++) {
+    for (p = flep_prof_bucket[b]; p; p = p->next) {
+      for (i = 0; i < p->nt - 1; i++) { /* all but FLEP_END */
+	struct FLEPOpStats* o = all + FLEP_OPCODE(p->text[i]);
+	o->count += p->calls;
+	o->ticks += flep_profile_ticks(p, i);
+      }
+    }
+  }
+  pthread_mutex_unlock(&flep_prof_lock);
+  for (i = 0; i <= FLEP_OUTPUT; i++) {
+    if (all[i].count == 0) continue;
+    all[i].name = dbg_strings[i];
+    all[m++] = all[i];
+  }
+  qsort(all, m, sizeof(all[0]), flep_compare_ops);
+  if (m > n) m = n;
+  memcpy(s, all, m * sizeof(all[0]));
+  return m;
+}
+
+int flep_stats_top(const struct FLEP** f, int n) {
+  struct FLEPProfile* p;
+  double* cost = (double*)malloc((n + 1) * sizeof(double));
+  size_t b;
+  int i, m = 0;
+  pthread_mutex_lock(&flep_prof_lock);
+  for (b = 0; b < flep_prof_nbucket; b++) {
+    for (p = flep_prof_bucket[b]; p; p = p->next) {
+      double c = p->batch_ticks;
+      for (i = 0; i < p->nt; i++) c += flep_profile_ticks(p, i);
+      /* insert into the "m" hottest so far */
+      for (i = m < n ? m++ : n; i > 0 && cost[i - 1] < c; i--) {
+	if (i < n) {
+	  cost[i] = cost[i - 1];
+	  f[i] = f[i - 1];
+	}
+      }
+      if (i < n) {
+	cost[i] = c;
+	f[i] = p->f;
+      }
+    }
+  }
+  pthread_mutex_unlock(&flep_prof_lock);
+  free(cost);
+  return m;
+}
+
+void flep_stats_reset(void) {
+  struct FLEPProfile* p;
+  size_t b;
+  pthread_mutex_lock(&flep_prof_lock);
+  for (b = 0; b < flep_prof_nbucket; b++) {
+    while ((p = flep_prof_bucket[b])) {
+      flep_prof_bucket[b] = p->next;
+      free(p->text);
+      free(p->ticks);
+      free(p);
+    }
+  }
+  flep_prof_n = 0;
+  pthread_mutex_unlock(&flep_prof_lock);
+}
+
+void flep_dump_stats(const struct FLEP* f) {
+  struct FLEPProfile* p;
+  double total = 0, *ticks;
+  int i;
+  pthread_mutex_lock(&flep_prof_lock);
+  p = flep_profile_of(f, 0);
+  if (!p || !p->samples) {
+    pthread_mutex_unlock(&flep_prof_lock);
+    printf("\nNo timed evaluations\n");
+    flep_dump(f);
+    return;
+  }
+  ticks = (double*)malloc(f->nt * sizeof(double));
+  for (i = 0; i < f->nt; i++) total += (ticks[i] = p->ticks[i] / p->samples);
+  printf("\n%lu calls, %lu timed, %.1f ticks per call; %lu rows in "
+    "batches, %.1f ticks per row\n", p->calls, p->samples, total, p->rows,
+    p->rows ? p->batch_ticks / p->rows : 0.0);
+  pthread_mutex_unlock(&flep_prof_lock);
+  for (i = 0; i < f->nt; i++) {
+    double share = total > 0 ? 100 * ticks[i] / total : 0;
+    printf("%5.1f%% %8.1f %s ", share, ticks[i], share >= 10 ? "*" : " ");
+    flep_dump_opcode(f, i);
+    printf("\n");
+  }
+  free(ticks);
+}
+#else
+int flep_stats(const struct FLEP* f, struct FLEPStats* s) {
+  (void)f;
+  memset(s, 0, sizeof(*s));
+  return 0;
+}
+
+int flep_stats_opcodes(struct FLEPOpStats* s, int n) {
+  (void)s;
+  (void)n;
+  return 0;
+}
+
+int flep_stats_top(const struct FLEP** f, int n) {
+  (void)f;
+  (void)n;
+  return 0;
+}
+
+void flep_stats_reset(void) {
+}
+
+void flep_dump_stats(const struct FLEP* f) {
+  printf("\nNo statistics, FLEP was built without FLEP_PROFILE\n");
+  flep_dump(f);
+}
+#endif
@@ -28,6 +28,8 @@
 */
 #ifndef FLEP_H
 #define FLEP_H
+#include <stddef.h>
+#include <stdio.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -49,17 +51,220 @@ const struct FLEP* flep_parse(const char* s, int* error,
 #define FLEP_BADTOKEN      21 /* bad token */
 #define FLEP_EXPECTED_OPEN 22 /* expected "(" (e.g. after "sin") */
 #define FLEP_UNBALANCED    23 /* unbalanced parentheses */
+#define FLEP_NOMEMORY      27 /* no room left in arena (flep_parse_arena) */
+
+const struct FLEP* flep_parse_flags(const char* s, int flags, int* error,
+  int* position);
+/* As "flep_parse", with "flags" an OR of the following (0 for none): */
+#define FLEP_FASTMATH 1 /* allow rewrites which may change results in the
+                         * last bits or for special values (e.g. x^3 as
+                         * x*x*x, x/3 as x*(1/3.), x^0.5 as sqrt(x)) */
+#define FLEP_APPROX 2   /* evaluate sin, cos, tan, exp, log and ^ with FLEP's
+                         * own functions, within 4 ULP rather than the C
+                         * library's (typically within 1 ULP), in double
+                         * precision only: vectorized by "flep_eval_batch",
+                         * taking 0.5 to 0.8 of the time there (log aside,
+                         * a little slower), but 1.2 to 2 times slower one
+                         * value at a time ("flep_eval", "flep_jit") */
 
 double flep_eval(const struct FLEP* f, double* val);
 /* Evaluate expression pointed to by "f" using arguments pointed to by "val"
  * - "f" was compiled with "flep_parse"
  * - "val" is an array of up to 7 values, the positions of which correspond
  *   to the variable names "abcxyzw", i.e. val[0] is "a", val[1] is "b", etc
+ * Expressions nesting too deep for the frame on the stack allocate one: if
+ * that fails, the result (of this and of every other evaluation function)
+ * is NaN.
+ */
+
+void flep_eval_batch(const struct FLEP* f, const double* const cols[7],
+  size_t n, double* out);
+/* Evaluate expression pointed to by "f" over "n" rows, storing the results
+ * in out[0..n-1]. Opcodes are dispatched once per block of rows rather than
+ * once per row, so this is much faster than calling "flep_eval" in a loop.
+ * - "cols" holds one column per variable "abcxyzw", i.e. row "i" of "a" is
+ *   cols[0][i]; columns of variables absent from the expression may be NULL
+ * - "f" must not be bound by "flep_bind" (see "flep_eval_records"): if it
+ *   is, nothing is evaluated and "out" is filled with NaN
+ */
+
+float flep_evalf(const struct FLEP* f, const float* val);
+void flep_eval_batchf(const struct FLEP* f, const float* const cols[7],
+  size_t n, float* out);
+/* Same as "flep_eval" and "flep_eval_batch" in single precision: variables,
+ * constants (rounded from those parsed), intermediate values and results
+ * are floats, and math functions those for floats. Batches take twice as
+ * many rows per vector instruction, and half the memory. "f" must not be
+ * bound by "flep_bind": if it is, "flep_evalf" returns NaN and
+ * "flep_eval_batchf" fills "out" with NaN.
+ */
+
+const struct FLEP* flep_parse_many(const char** exprs, int n, int flags,
+  int* error, int* position, int* which);
+/* Compile the "n" expressions in "exprs" into a single program, computing
+ * subexpressions they have in common only once. Arguments are as for
+ * "flep_parse_flags"; if parsing fails, "*which" (if "which" is not null)
+ * is the index of the expression in error.
+ */
+
+int flep_outputs(const struct FLEP* f);
+/* Number of results of "f": "n" if from "flep_parse_many", else 1 */
+
+int flep_variables(const struct FLEP* f);
+/* Variables used by "f", bit 0 for "a" up to bit 6 for "w" */
+
+void flep_eval_many(const struct FLEP* f, double* val, double* out);
+/* Evaluate all expressions of "f" (from "flep_parse_many") at once, with
+ * the arguments in "val" as for "flep_eval", storing the result of
+ * expression "i" in out[i]. "flep_eval" on such a program returns the
+ * last result only.
+ * "flep_eval_batch" also takes these programs, and writes the "n" rows of
+ * expression "i" to out[i*n] to out[i*n+n-1].
+ */
+
+double flep_eval_grad(const struct FLEP* f, double* val, double* grad);
+/* Same as "flep_eval", also storing in grad[0] to grad[6] the partial
+ * derivatives of the result with respect to a, b, c, x, y, z and w (0 for
+ * those absent), computed exactly in the same pass rather than by finite
+ * differences. For programs from "flep_parse_many", those of the last
+ * expression. "f" must not be bound by "flep_bind": if it is, NaN is
+ * returned, as every derivative.
+ */
+
+const struct FLEP* flep_specialize(const struct FLEP* f, int mask,
+  const double* values);
+/* Compile a new expression from "f" with the variables in "mask" (bit 0 for
+ * "a" up to bit 6 for "w") fixed to their values in "values" (values[0]
+ * for "a" and so on), folding everything that depends only on them. Free
+ * it with "flep_free". Returns NULL if "f" is bound by "flep_bind".
+ */
+
+struct FLEPContext; /* Opaque to user */
+
+struct FLEPContext* flep_context_new(const struct FLEP* f);
+/* Create a context to evaluate "f" over and over as only some variables
+ * change. It keeps the value of every subexpression between calls, so it
+ * must not be shared by threads. Returns NULL if "f" is bound by
+ * "flep_bind". "f" must outlive it.
+ */
+
+double flep_context_eval(struct FLEPContext* c, double* val, int dirty);
+/* Same as "flep_eval", recomputing only subexpressions depending on the
+ * variables in "dirty" (bit 0 for "a" up to bit 6 for "w"): those changed
+ * since the last call on "c". Everything is computed on the first call.
+ */
+
+void flep_context_free(struct FLEPContext* c);
+/* Deallocate "c" */
+
+struct FLEPLayout {
+  size_t offset[7]; /* of variables a, b, c, x, y, z and w in a record */
+  size_t stride; /* bytes from one record to the next */
+};
+
+const struct FLEP* flep_bind(const struct FLEP* f,
+  const struct FLEPLayout* layout);
+/* Copy "f" into a new expression reading its variables from records laid
+ * out as in "layout", where they are stored as doubles (e.g. fields of a
+ * struct). Offsets of variables "f" does not use are ignored; the others,
+ * and the stride, must be multiples of sizeof(double). Returns NULL if
+ * they are not, or if "f" is itself bound. Free the copy with "flep_free".
+ * A bound expression is evaluated with the records in place of "val" or
+ * "cols", which it reads in place: by "flep_eval_record" (or "flep_eval",
+ * "flep_eval_many" and "flep_jit" given the record cast to double*), and
+ * by "flep_eval_records" instead of "flep_eval_batch".
+ */
+
+double flep_eval_record(const struct FLEP* f, const void* record);
+/* Evaluate "f", bound by "flep_bind", on one record (aligned as a double) */
+
+void flep_eval_records(const struct FLEP* f, const void* records, size_t n,
+  double* out);
+/* As "flep_eval_batch", for "f" bound by "flep_bind", over "n" records
+ * one stride apart starting at "records"; if "f" is not bound, nothing is
+ * evaluated and "out" is filled with NaN
+ */
+
+size_t flep_stride(const struct FLEP* f);
+/* Bytes per record if "f" is bound by "flep_bind", else 0 */
+
+typedef double (*FLEPFunc)(const struct FLEP* f, double* val);
+FLEPFunc flep_jit(const struct FLEP* f);
+/* Translate "f" into native code, returning a function which is called just
+ * like "flep_eval" (and must be given the same "f"), only faster.
+ * Only x86-64 is supported: elsewhere, when built with FLEP_NO_JIT, or for
+ * expressions too deep for the registers or from "flep_parse_many",
+ * "flep_eval" itself is returned.
+ * Release the code with "flep_jit_free" (before or after freeing "f").
+ */
+void flep_jit_free(FLEPFunc fn);
+
+int flep_emit_c_header(FILE* file);
+int flep_emit_c(const struct FLEP* f, const char* name, FILE* file);
+int flep_emit_c_batch(const struct FLEP* f, const char* name, FILE* file);
+/* Write "f" to "file" as C source of a function called "name", for builds
+ * where code cannot be generated at run time: compiled (e.g. with other
+ * expressions into a shared object, to be loaded with "dlopen"), it gives
+ * the results of "flep_eval" bit for bit, as long as it is not with
+ * -ffast-math. The function is
+ *   double name(const double* val)
+ * as "flep_eval", or for programs from "flep_parse_many"
+ *   void name(const double* val, double* out)
+ * as "flep_eval_many". That of "flep_emit_c_batch" is
+ *   void name(const double* const cols[7], size_t n, double* out)
+ * as "flep_eval_batch", or if "f" is bound by "flep_bind"
+ *   void name(const void* records, size_t n, double* out)
+ * as "flep_eval_records". Any number of functions can be written to the
+ * same file, after the includes and pragmas they need, written once by
+ * "flep_emit_c_header". Returns 0 if writing failed, or if "f" was parsed
+ * with FLEP_APPROX, whose functions are FLEP's own (nothing is written).
+ */
+
+/* Memory supplied by the caller for "flep_parse_arena" */
+struct FLEPArena {
+  char* base; /* start of the memory, aligned to 8 bytes */
+  size_t size; /* bytes at "base" */
+  size_t used; /* bytes already taken, 0 to start with */
+};
+
+const struct FLEP* flep_parse_arena(struct FLEPArena* arena, const char* s,
+  int flags, int* error, int* position);
+/* As "flep_parse_flags", but the expression is put in the unused memory of
+ * "arena" (whose "used" grows by about "flep_memory" bytes) rather than
+ * allocated on its own. Fails with FLEP_NOMEMORY if it does not fit.
+ * Calling "flep_free" on it does nothing: all expressions in an arena go
+ * at once, when the caller frees or reuses (setting "used" to 0) its memory.
  */
 
 /* Deallocate memory of "f" previously returned by "flep_parse" */
 void flep_free(const struct FLEP* f);
 
+/* Number of bytes of memory held by "f" */
+size_t flep_memory(const struct FLEP* f);
+
+size_t flep_serialize(const struct FLEP* f, void* buf, size_t size);
+/* Write a binary image of "f" to "buf" if it is at least "size" bytes,
+ * returning the number of bytes of the image either way (so call with
+ * a null "buf" to learn how much room is needed). The size is always a
+ * multiple of 8, so images written one after the other to a buffer aligned
+ * to 8 bytes are all aligned as well.
+ */
+
+const struct FLEP* flep_load(const void* image, size_t size, size_t* used);
+/* Return the expression held by the image at "image", written by
+ * "flep_serialize" and at most "size" bytes long. Nothing is copied nor
+ * allocated: the expression is the image itself, which must stay in place
+ * (and aligned to 8 bytes) while in use, e.g. in a file mapped with "mmap".
+ * Calling "flep_free" on it does nothing.
+ * If "used" is not null, "*used" is set to the size of the image, i.e. the
+ * offset of the next image when several are stored one after the other.
+ * Returns NULL if the image is not valid, or was written by a version of
+ * FLEP or a machine with a different binary layout.
+ * The expression may be bound by "flep_bind", and then reads its variables
+ * from records of "flep_stride" bytes rather than from 7 values: unless
+ * the image is trusted, check "flep_stride" before evaluating it.
+ */
+
 /* Return string value for code "c" previously returned in "error" 
  * after a failed call to "flep_parse".
  */
@@ -67,6 +272,53 @@ const char* flep_translate(int c);
 
 /* For debugging and curiosity satisfaction: dump opcodes to stdout */
 void flep_dump(const struct FLEP* f);
+
+/* Profiling. Built with FLEP_PROFILE defined, FLEP counts the evaluations
+ * of each expression and times one scalar evaluation in FLEP_PROFILE_PERIOD
+ * (64 by default) opcode by opcode, in "ticks": cycles of the timestamp
+ * counter on x86, nanoseconds elsewhere. This takes a lock per call, so it
+ * costs a few tens of nanoseconds per evaluation. Built without it, none of
+ * this is done, and the functions below report nothing.
+ * Batches are timed as a whole, "flep_evalf" is counted but not timed,
+ * and code from "flep_jit" is not seen at all.
+ */
+struct FLEPStats {
+  unsigned long calls; /* scalar evaluations */
+  unsigned long rows; /* rows evaluated in batches */
+  unsigned long samples; /* scalar evaluations timed */
+  double ticks; /* estimated for all scalar evaluations */
+  double batch_ticks; /* spent in batches */
+};
+
+int flep_stats(const struct FLEP* f, struct FLEPStats* s);
+/* Fill "s" with the counters of "f", returning 0 (and zeros) if "f" was not
+ * evaluated since it was parsed or since "flep_stats_reset".
+ */
+
+struct FLEPOpStats {
+  const char* name; /* e.g. "FLEP_POWER", as "flep_dump" prints it */
+  double count; /* executions in scalar evaluations */
+  double ticks; /* estimated for all those executions */
+};
+
+int flep_stats_opcodes(struct FLEPOpStats* s, int n);
+/* Fill up to "n" entries of "s" with totals per kind of opcode over all
+ * expressions, most ticks first, returning the number filled.
+ */
+
+int flep_stats_top(const struct FLEP** f, int n);
+/* Fill up to "n" entries of "f" with the expressions taking most ticks,
+ * scalar and batch, most first, returning the number filled. They are only
+ * valid while not freed.
+ */
+
+void flep_stats_reset(void);
+/* Forget all counters */
+
+void flep_dump_stats(const struct FLEP* f);
+/* Dump the opcodes of "f" to stdout with the ticks each takes on average
+ * per evaluation, marking with "*" those taking at least 10% of them
+ */
 #ifdef __cplusplus
 }
 #endif
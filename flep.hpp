@@ -0,0 +1,656 @@
+/*
+ * FLEP - Fast Lite Expression Parser
+ * Copyright (C) 2019 Gustavo Hime
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * C++ interface (C++17 or later), header only.
+ * - "flep::Expression" owns a "struct FLEP" parsed at run time, freeing it
+ *   when destroyed; it can be moved but not copied.
+ * - FLEP_LITERAL("sin(a) + b") (or "sin(a) + b"_flep in C++20) parses a
+ *   string literal at compile time, with the grammar of "flep_parse", into
+ *   an object of a type of its own, "flep::Compiled<...>", called like
+ *   "flep_eval" and evaluating the expression as if written in C++, e.g.
+ *   std::sin(val[0]) + val[1], with nothing left to interpret. Results are
+ *   those of "flep_eval" (without flags). Syntax errors fail to compile,
+ *   naming the error code and position in "flep::detail::ParseError".
+ */
+#ifndef FLEP_HPP
+#define FLEP_HPP
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include "flep.h"
+
+#if defined(__GNUC__)
+#define FLEP_INLINE inline __attribute__((always_inline))
+#else
+#define FLEP_INLINE inline
+#endif
+
+namespace flep {
+
+/* Thrown when "flep_parse" fails, with its error code and position */
+class Error : public std::runtime_error {
+ public:
+  Error(int error, int position)
+    : std::runtime_error(flep_translate(error)), error_(error),
+      position_(position) {}
+  int error() const noexcept { return error_; }
+  int position() const noexcept { return position_; }
+ private:
+  int error_, position_;
+};
+
+/* Expression compiled at run time, freed by the destructor */
+class Expression {
+ public:
+  Expression() noexcept : f_(nullptr) {}
+  /* "s" as by "flep_parse_flags", throwing "flep::Error" if it fails */
+  explicit Expression(const char* s, int flags = 0) : f_(nullptr) {
+    int error = FLEP_OK, position = 0;
+    f_ = flep_parse_flags(s, flags, &error, &position);
+    if (!f_) throw Error(error, position);
+  }
+  /* taking ownership of "f", e.g. from "flep_specialize" or "flep_load" */
+  explicit Expression(const struct FLEP* f) noexcept : f_(f) {}
+  Expression(Expression&& x) noexcept : f_(x.release()) {}
+  Expression& operator=(Expression&& x) noexcept {
+    reset(x.release());
+    return *this;
+  }
+  Expression(const Expression&) = delete;
+  Expression& operator=(const Expression&) = delete;
+  ~Expression() { flep_free(f_); }
+
+  /* as "flep_eval", which only reads "val" */
+  double operator()(const double* val) const {
+    return flep_eval(f_, const_cast<double*>(val));
+  }
+  /* as "flep_eval_batch" */
+  void operator()(const double* const cols[7], size_t n, double* out) const {
+    flep_eval_batch(f_, cols, n, out);
+  }
+
+  const struct FLEP* get() const noexcept { return f_; }
+  explicit operator bool() const noexcept { return f_ != nullptr; }
+  /* give up ownership of the expression, to be freed by the caller */
+  const struct FLEP* release() noexcept {
+    const struct FLEP* f = f_;
+    f_ = nullptr;
+    return f;
+  }
+  void reset(const struct FLEP* f = nullptr) noexcept {
+    const struct FLEP* old = f_;
+    f_ = f;
+    flep_free(old);
+  }
+ private:
+  const struct FLEP* f_;
+};
+
+namespace detail {
+
+/* tokens and opcodes, with the values they have in flep.c, which are
+ * also the error codes of unexpected tokens
+ */
+enum {
+  FLEP_UNARY_MINUS = 1, FLEP_OPEN, FLEP_CLOSE, FLEP_PLUS, FLEP_MINUS,
+  FLEP_MULT, FLEP_DIV, FLEP_POWER, FLEP_VAR, FLEP_CONST, FLEP_SIN, FLEP_COS,
+  FLEP_TAN, FLEP_EXP, FLEP_LOG, FLEP_ABS, FLEP_SQRT, FLEP_START, FLEP_END
+};
+
+/* class of a character, as in "flep_chars" */
+constexpr int char_class(char c) {
+  switch (c) {
+    case 0: return FLEP_END;
+    case '\t': case '\n': case '\v': case '\f': case '\r': case ' ':
+      return FLEP_START;
+    case '(': return FLEP_OPEN;
+    case ')': return FLEP_CLOSE;
+    case '*': return FLEP_MULT;
+    case '+': return FLEP_PLUS;
+    case '-': return FLEP_MINUS;
+    case '/': return FLEP_DIV;
+    case '^': return FLEP_POWER;
+  }
+  if (c >= '0' && c <= '9') return FLEP_CONST;
+  if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) return FLEP_VAR;
+  return FLEP_BADTOKEN;
+}
+
+constexpr int hexdigit(char d) {
+  if (d >= '0' && d <= '9') return d - '0';
+  if (d >= 'a' && d <= 'f') return d - 'a' + 10;
+  if (d >= 'A' && d <= 'F') return d - 'A' + 10;
+  return -1;
+}
+
+constexpr int length(const char* s) {
+  int n = 0;
+  while (s[n]) n++;
+  return n;
+}
+
+/* 2^k, for |k| <= 1000 */
+constexpr double pow2(int k) {
+  double x = 1;
+  for (; k > 0; k--) x *= 2;
+  for (; k < 0; k++) x *= 0.5;
+  return x;
+}
+
+/* "q" times 2^k, in one rounding (none if the result is subnormal) */
+constexpr double scale2(std::uint64_t q, int k) {
+  double x = (double)q;
+  if (k < -1000) {
+    x *= pow2(-1000);
+    k += 1000;
+  }
+  return x * pow2(k);
+}
+
+/* Unsigned integer of up to 4096 bits, for numbers whose exact value
+ * does not come from a single operation on doubles
+ */
+struct Big {
+  std::uint32_t w[128] = {};
+  int n = 0; /* words in use, the last nonzero */
+
+  constexpr void mul_add(std::uint32_t m, std::uint32_t a) {
+    std::uint64_t c = a;
+    for (int i = 0; i < n; i++) {
+      c += (std::uint64_t)w[i] * m;
+      w[i] = (std::uint32_t)c;
+      c >>= 32;
+    }
+    if (c) w[n++] = (std::uint32_t)c;
+  }
+  constexpr void shl(int s) {
+    int k = s / 32, b = s % 32;
+    if (!n) return;
+    w[n + k] = 0;
+    for (int i = n - 1; i >= 0; i--) {
+      w[i + k + 1] |= b ? w[i] >> (32 - b) : 0;
+      w[i + k] = w[i] << b;
+    }
+    for (int i = 0; i < k; i++) w[i] = 0;
+    n += k + 1;
+    trim();
+  }
+  constexpr void shr1() {
+    for (int i = 0; i < n; i++) {
+      w[i] = w[i] >> 1 | (i + 1 < n ? w[i + 1] << 31 : 0);
+    }
+    trim();
+  }
+  constexpr void sub(const Big& x) { /* *this >= x */
+    std::int64_t c = 0;
+    for (int i = 0; i < n; i++) {
+      c += (std::int64_t)w[i] - (i < x.n ? x.w[i] : 0);
+      w[i] = (std::uint32_t)c;
+      c = c < 0 ? -1 : 0;
+    }
+    trim();
+  }
+  constexpr int compare(const Big& x) const {
+    if (n != x.n) return n < x.n ? -1 : 1;
+    for (int i = n - 1; i >= 0; i--) {
+      if (w[i] != x.w[i]) return w[i] < x.w[i] ? -1 : 1;
+    }
+    return 0;
+  }
+  constexpr int bits() const {
+    int b = 32 * n;
+    if (n) {
+      for (std::uint32_t t = w[n - 1]; !(t & 0x80000000u); t <<= 1) b--;
+    }
+    return b;
+  }
+  constexpr void trim() {
+    while (n && !w[n - 1]) n--;
+  }
+};
+
+/* "num" / "den" (both nonzero) rounded to the nearest double, ties to
+ * even, by dividing to 53 significant bits (fewer if subnormal)
+ */
+constexpr double ratio(Big num, Big den) {
+  int k = num.bits() - den.bits() - 53, c = 0;
+  std::uint64_t q = 0;
+  bool up = false;
+  if (k < -1074) k = -1074;
+  if (k > 0) den.shl(k);
+  else num.shl(-k);
+  den.shl(54); /* the quotient is below 2^54 */
+  for (int i = 54; i >= 0; i--) {
+    if (num.compare(den) >= 0) {
+      num.sub(den);
+      q |= (std::uint64_t)1 << i;
+    }
+    if (i) den.shr1();
+  }
+  if (q >> 53) {
+    up = (q & 1) && (num.n || (q & 2));
+    q >>= 1;
+    k++;
+  } else {
+    num.shl(1);
+    c = num.compare(den);
+    up = c > 0 || (c == 0 && (q & 1));
+  }
+  return scale2(q + up, k);
+}
+
+/* "x" times 10^e */
+constexpr void mul_pow10(Big& x, int e) {
+  for (; e >= 9; e -= 9) x.mul_add(1000000000u, 0);
+  for (; e > 0; e--) x.mul_add(10, 0);
+}
+
+/* Number at s[i], moving "i" past it, as read by "flep_number" (which
+ * rounds correctly, as does this): the same fast path, and otherwise the
+ * exact value as a ratio of integers
+ */
+constexpr double number(const char* s, int& i) {
+  int p = i, base = 10, d = 0, digits = 0, nint = 0, nfrac = 0, e = 0;
+  int sign = 1;
+  bool hex = false, exact = true;
+  double m = 0;
+  if (s[p] == '0' && (s[p + 1] == 'x' || s[p + 1] == 'X') &&
+      (hexdigit(s[p + 2]) >= 0 ||
+      (s[p + 2] == '.' && hexdigit(s[p + 3]) >= 0))) {
+    hex = true;
+    base = 16;
+    p += 2;
+  }
+  digits = p;
+  for (; (d = hex ? hexdigit(s[p]) : s[p] - '0') >= 0 && d < base; p++) {
+    if (m > 900719925474098.0) exact = false; /* m * 10 + 9 <= 2^53 */
+    m = m * base + d;
+  }
+  nint = p - digits;
+  if (s[p] == '.') {
+    for (p++; (d = hex ? hexdigit(s[p]) : s[p] - '0') >= 0 && d < base;
+      p++, nfrac++) {
+      if (m > 900719925474098.0) exact = false;
+      m = m * base + d;
+    }
+  }
+  if ((s[p] == (hex ? 'p' : 'e') || s[p] == (hex ? 'P' : 'E')) &&
+      (char_class(s[p + 1]) == FLEP_CONST || ((s[p + 1] == '+' ||
+      s[p + 1] == '-') && char_class(s[p + 2]) == FLEP_CONST))) {
+    p++;
+    if (s[p] == '+' || s[p] == '-') sign = (s[p++] == '-') ? -1 : 1;
+    for (; char_class(s[p]) == FLEP_CONST; p++) {
+      if (e < 100000) e = e * 10 + (s[p] - '0');
+    }
+    e *= sign;
+  }
+  i = p;
+  if (m == 0) return 0;
+  if (!hex && exact && e - nfrac >= -22 && e - nfrac <= 22) {
+    double t = 1;
+    for (int k = 0; k < (e - nfrac < 0 ? nfrac - e : e - nfrac); k++) {
+      t *= 10;
+    }
+    return e - nfrac < 0 ? m / t : m * t;
+  }
+  /* The significant digits, up to as many as a value halfway between two
+   * doubles may have, past which any nonzero ones count as a trailing 1:
+   * "num" times base^(lead - kept + 1), "lead" being the place of the
+   * first, times 10^e, or 2^e if hexadecimal
+   */
+  Big num, den;
+  int lead = 0, kept = 0, place = nint;
+  bool sticky = false;
+  for (int k = digits; k < p && place > -nfrac; k++) {
+    if (s[k] == '.') continue;
+    d = hex ? hexdigit(s[k]) : s[k] - '0';
+    place--;
+    if (!kept && !d) continue;
+    if (!kept) lead = place;
+    if (kept < (hex ? 16 : 780)) {
+      num.mul_add(base, d);
+      kept++;
+    } else if (d) {
+      sticky = true;
+    }
+  }
+  if (sticky) {
+    num.mul_add(base, 1);
+    kept++;
+  }
+  den.mul_add(1, 1);
+  if (hex) {
+    e += 4 * (lead - kept + 1);
+    if (num.bits() + e > 1025) return HUGE_VAL;
+    if (num.bits() + e < -1075) return 0;
+    if (e >= 0) num.shl(e);
+    else den.shl(-e);
+  } else {
+    if (lead + e > 309) return HUGE_VAL;
+    if (lead + e < -325) return 0;
+    e += lead - kept + 1;
+    if (e >= 0) mul_pow10(num, e);
+    else mul_pow10(den, -e);
+  }
+  return ratio(num, den);
+}
+
+/* node of a parsed literal: operation, operands (or variable) and value */
+struct Node {
+  int op = 0, a = -1, b = -1;
+  double val = 0;
+};
+
+/* Literal of length below "N" parsed into a tree (a node per opcode of
+ * "flep_parse", before rewrites), or an error and its position as given
+ * by "flep_parse"
+ */
+template <int N>
+struct Program {
+  Node node[N];
+  int root = -1, error = FLEP_OK, position = 0;
+};
+
+/* Recursive descent, as by "flep_get_sum" and the functions it calls,
+ * from tokens as by "flep_next": nodes are made where those functions
+ * add opcodes, taking their operands from a stack
+ */
+template <int N>
+class Parser {
+ public:
+  constexpr explicit Parser(const char* s) : src(s) {}
+
+  constexpr Program<N> parse() {
+    int status = (next(), get_sum());
+    if (status != FLEP_END) {
+      out.error = status;
+      out.position = p + 1;
+    } else {
+      out.root = stack[0];
+    }
+    return out;
+  }
+
+ private:
+  const char* src;
+  int p = 0, q = 0, ival = 0, curr = FLEP_START, last = FLEP_START;
+  double fval = 0;
+  Program<N> out;
+  int n = 0, stack[N] = {}, sp = 0;
+
+  constexpr void add(int op, int a, double val) {
+    Node& k = out.node[n];
+    int arity = (op == FLEP_VAR || op == FLEP_CONST) ? 0 :
+      (op == FLEP_UNARY_MINUS || op >= FLEP_SIN) ? 1 : 2;
+    if (sp < arity) return; /* after an error */
+    k.op = op;
+    k.val = val;
+    k.a = arity == 2 ? stack[sp - 2] : arity ? stack[sp - 1] : a;
+    k.b = arity == 2 ? stack[sp - 1] : -1;
+    sp -= arity;
+    stack[sp++] = n++;
+  }
+
+  constexpr int next() {
+    int c = FLEP_START, len = 0;
+    last = curr;
+    while ((c = char_class(src[q])) == FLEP_START) q++;
+    p = q++;
+    switch (c) {
+      case FLEP_VAR:
+	while (char_class(src[q]) == FLEP_VAR) q++;
+	len = q - p;
+	c = FLEP_BADTOKEN;
+	if (len == 1) {
+	  switch (src[p]) {
+	    case 'a': c = FLEP_VAR; ival = 0; break;
+	    case 'b': c = FLEP_VAR; ival = 1; break;
+	    case 'c': c = FLEP_VAR; ival = 2; break;
+	    case 'x': c = FLEP_VAR; ival = 3; break;
+	    case 'y': c = FLEP_VAR; ival = 4; break;
+	    case 'z': c = FLEP_VAR; ival = 5; break;
+	    case 'w': c = FLEP_VAR; ival = 6; break;
+	    case 'e': c = FLEP_CONST; fval = 2.71828182845904523536; break;
+	  }
+	} else if (len == 2 && name("pi")) {
+	  c = FLEP_CONST;
+	  fval = 3.14159265358979323846;
+	} else if (len == 3) {
+	  c = name("sin") ? FLEP_SIN : name("cos") ? FLEP_COS :
+	    name("tan") ? FLEP_TAN : name("exp") ? FLEP_EXP :
+	    name("log") ? FLEP_LOG : name("abs") ? FLEP_ABS : c;
+	} else if (len == 4 && name("sqrt")) {
+	  c = FLEP_SQRT;
+	}
+	break;
+      case FLEP_CONST:
+	q = p;
+	fval = number(src, q);
+	break;
+      case FLEP_END:
+	q = p;
+	break;
+    }
+    return curr = c;
+  }
+
+  /* whether the name at "p" is "s" */
+  constexpr bool name(const char* s) const {
+    for (int i = 0; s[i]; i++) {
+      if (src[p + i] != s[i]) return false;
+    }
+    return true;
+  }
+
+  constexpr int get_operand() {
+    int ret = FLEP_BADSYNTAX;
+    if (curr == FLEP_OPEN) {
+      next();
+      ret = get_sum();
+      if (ret != FLEP_CLOSE) return FLEP_UNBALANCED;
+      ret = next();
+    } else if (curr == FLEP_PLUS) {
+      if (last == FLEP_START || last == FLEP_OPEN || last == FLEP_PLUS ||
+	  last == FLEP_MULT || last == FLEP_DIV || last == FLEP_POWER) {
+	next();
+	ret = get_operand();
+      }
+    } else if (curr == FLEP_MINUS) {
+      if (last == FLEP_START || last == FLEP_OPEN || last == FLEP_MULT ||
+	  last == FLEP_DIV) {
+	next();
+	ret = get_prod();
+      } else if (last == FLEP_POWER) {
+	next();
+	ret = get_power();
+      } else {
+	next();
+	ret = get_operand();
+      }
+      add(FLEP_UNARY_MINUS, 0, 0);
+    } else if (curr >= FLEP_SIN && curr <= FLEP_SQRT) {
+      int op = curr;
+      next();
+      if (curr != FLEP_OPEN) return FLEP_EXPECTED_OPEN;
+      ret = get_operand();
+      add(op, 0, 0);
+    } else if (curr == FLEP_CONST) {
+      add(FLEP_CONST, 0, fval);
+      ret = next();
+    } else if (curr == FLEP_VAR) {
+      add(FLEP_VAR, ival, 0);
+      ret = next();
+    }
+    return ret;
+  }
+
+  constexpr int get_power() {
+    int ret = get_operand();
+    while (ret == FLEP_POWER) {
+      next();
+      ret = get_power();
+      add(FLEP_POWER, 0, 0);
+    }
+    return ret;
+  }
+
+  constexpr int get_prod() {
+    int ret = get_power();
+    while (ret == FLEP_MULT || ret == FLEP_DIV) {
+      int op = ret;
+      next();
+      ret = get_power();
+      add(op, 0, 0);
+    }
+    return ret;
+  }
+
+  constexpr int get_sum() {
+    int ret = get_prod();
+    while (ret == FLEP_PLUS || ret == FLEP_MINUS) {
+      int op = ret;
+      ret = next();
+      while (ret == FLEP_PLUS || ret == FLEP_MINUS) {
+	op = (op == ret) ? FLEP_PLUS : FLEP_MINUS;
+	ret = next();
+      }
+      ret = get_prod();
+      add(op, 0, 0);
+    }
+    return ret;
+  }
+};
+
+template <int N>
+constexpr Program<N> parse(const char* s) {
+  return Parser<N>(s).parse();
+}
+
+/* Value of node "I" of "P::program", as C++ would compute it */
+template <class P, int I>
+struct Eval {
+  static FLEP_INLINE double run(const double* v) {
+    constexpr const Node& k = P::program.node[I];
+    if constexpr (k.op == FLEP_CONST) {
+      return k.val;
+    } else if constexpr (k.op == FLEP_VAR) {
+      return v[k.a];
+    } else if constexpr (k.op == FLEP_UNARY_MINUS) {
+      return -Eval<P, k.a>::run(v);
+    } else if constexpr (k.op == FLEP_PLUS) {
+      return Eval<P, k.a>::run(v) + Eval<P, k.b>::run(v);
+    } else if constexpr (k.op == FLEP_MINUS) {
+      return Eval<P, k.a>::run(v) - Eval<P, k.b>::run(v);
+    } else if constexpr (k.op == FLEP_MULT) {
+      return Eval<P, k.a>::run(v) * Eval<P, k.b>::run(v);
+    } else if constexpr (k.op == FLEP_DIV) {
+      return Eval<P, k.a>::run(v) / Eval<P, k.b>::run(v);
+    } else if constexpr (k.op == FLEP_POWER) {
+      return std::pow(Eval<P, k.a>::run(v), Eval<P, k.b>::run(v));
+    } else if constexpr (k.op == FLEP_SIN) {
+      return std::sin(Eval<P, k.a>::run(v));
+    } else if constexpr (k.op == FLEP_COS) {
+      return std::cos(Eval<P, k.a>::run(v));
+    } else if constexpr (k.op == FLEP_TAN) {
+      return std::tan(Eval<P, k.a>::run(v));
+    } else if constexpr (k.op == FLEP_EXP) {
+      return std::exp(Eval<P, k.a>::run(v));
+    } else if constexpr (k.op == FLEP_LOG) {
+      return std::log(Eval<P, k.a>::run(v));
+    } else if constexpr (k.op == FLEP_ABS) {
+      return std::fabs(Eval<P, k.a>::run(v));
+    } else {
+      return std::sqrt(Eval<P, k.a>::run(v));
+    }
+  }
+};
+
+/* fails to compile, with the error and position in the message, unless
+ * "error" is FLEP_OK
+ */
+template <int error, int position>
+struct ParseError {
+  static_assert(error == FLEP_OK, "FLEP failed to parse the literal");
+  static constexpr bool ok = error == FLEP_OK;
+};
+
+}  /* namespace detail */
+
+/* Expression of the string returned by "Source::str()", parsed at compile
+ * time, made by FLEP_LITERAL
+ */
+template <class Source>
+class Compiled {
+ public:
+  static constexpr detail::Program<detail::length(Source::str()) + 1>
+    program = detail::parse<detail::length(Source::str()) + 1>(
+      Source::str());
+  static_assert(detail::ParseError<program.error, program.position>::ok);
+
+  /* as "flep_eval" */
+  FLEP_INLINE double operator()(const double* val) const {
+    if constexpr (program.error == FLEP_OK) {
+      return detail::Eval<Compiled, program.root>::run(val);
+    } else {
+      return 0;
+    }
+  }
+  static constexpr const char* source() { return Source::str(); }
+};
+
+/* "flep::Compiled" object for the string literal "s" */
+#define FLEP_LITERAL(s) ([] { \
+    struct FLEPSource { \
+      static constexpr const char* str() { return s; } \
+    }; \
+    return ::flep::Compiled<FLEPSource>(); \
+  }())
+
+#if defined(__cpp_nontype_template_args) && \
+  __cpp_nontype_template_args >= 201911L
+namespace detail {
+
+/* string literal as a template argument */
+template <int N>
+struct String {
+  char s[N] = {};
+  constexpr String(const char (&x)[N]) {
+    for (int i = 0; i < N; i++) s[i] = x[i];
+  }
+};
+
+template <String S>
+struct StringSource {
+  static constexpr const char* str() { return S.s; }
+};
+
+}  /* namespace detail */
+
+/* "sin(a) + b"_flep, as FLEP_LITERAL("sin(a) + b") */
+inline namespace literals {
+template <detail::String S>
+constexpr Compiled<detail::StringSource<S>> operator""_flep() {
+  return {};
+}
+}  /* namespace literals */
+#endif
+
+}  /* namespace flep */
+
+#endif
@@ -0,0 +1,344 @@
+/*
+ * FLEP - Fast Lite Expression Parser
+ * Copyright (C) 2019 Gustavo Hime
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Cache of compiled expressions keyed by normalized expression string.
+ * Entries are spread over shards by the hash of their string, each shard
+ * with its own lock, hash table and LRU list, so threads looking up
+ * different strings seldom wait for each other. Expressions are parsed
+ * with no lock held. Releasing finds the entry of an expression through a
+ * second index, keyed by pointer and sharded the same way.
+ * No thread ever holds two locks at once.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flep_cache.h"
+
+#define FLEP_SHARDS 16 /* power of two */
+
+struct FLEPEntry {
+  const struct FLEP* f;
+  char* key; /* normalized string */
+  unsigned long hash; /* of "key" */
+  size_t bytes; /* memory of "f" and "key" */
+  int refs; /* references from "flep_cache_get" */
+  int cached; /* whether still in the cache, not just referenced */
+  struct FLEPEntry* next; /* chain in the hash table */
+  struct FLEPEntry *older, *newer; /* LRU list */
+  struct FLEPEntry* pnext; /* chain in the pointer index */
+};
+
+struct FLEPShard {
+  pthread_mutex_t lock;
+  struct FLEPEntry** bucket;
+  unsigned long nbucket, n; /* power of two, number of entries */
+  struct FLEPEntry *newest, *oldest;
+  size_t bytes;
+  unsigned long hits, misses, evictions;
+};
+
+struct FLEPPtrShard {
+  pthread_mutex_t lock;
+  struct FLEPEntry** bucket;
+  unsigned long nbucket, n;
+};
+
+struct FLEPCache {
+  struct FLEPShard shard[FLEP_SHARDS];
+  struct FLEPPtrShard ptr[FLEP_SHARDS];
+  size_t max_bytes; /* per shard */
+  int flags; /* for "flep_parse_flags" */
+};
+
+/* 32 bit FNV-1a */
+static unsigned long flep_cache_hash(const char* s) {
+  unsigned long h = 2166136261UL;
+  while (*s) h = ((h ^ (unsigned char)*s++) * 16777619UL) & 0xffffffffUL;
+  return h;
+}
+
+static unsigned long flep_ptr_hash(const struct FLEP* f) {
+  unsigned long h = (unsigned long)(size_t)f;
+  h ^= h >> 4;
+  h = (h * 2654435761UL) & 0xffffffffUL;
+  return h ^ (h >> 16);
+}
+
+/* shard of a hash, from its high bits (the low ones pick buckets) */
+#define FLEP_SHARD(h) (((h) >> 24) & (FLEP_SHARDS - 1))
+
+/* whether "c" is a blank, and whether it may be part of a number or a
+ * name, in ASCII as for the scanner of "flep_parse" (unlike <ctype.h>, in
+ * whatever locale), so that no key matches a string it would reject
+ */
+#define FLEP_BLANK(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+#define FLEP_WORD(c) (((c) >= 'a' && (c) <= 'z') || \
+  ((c) >= 'A' && (c) <= 'Z') || ((c) >= '0' && (c) <= '9') || (c) == '.')
+
+/* Copy of "s" without whitespace, except single blanks where dropping it
+ * would join tokens, e.g. "1 2", or make an exponent of e.g. "1e -2"
+ */
+static char* flep_normalize(const char* s) {
+  char *key = (char*)malloc(strlen(s) + 1), *q = key;
+  int blank = 0;
+  for (; *s; s++) {
+    if (FLEP_BLANK(*s)) {
+      blank = 1;
+      continue;
+    }
+    if (blank && q > key && ((FLEP_WORD(q[-1]) && FLEP_WORD(*s)) ||
+        (strchr("eEpP", q[-1]) && (*s == '+' || *s == '-')))) {
+      *q++ = ' ';
+    }
+    blank = 0;
+    *q++ = *s;
+  }
+  *q = 0;
+  return key;
+}
+
+/* double the buckets of a table chained through "next" or "pnext" */
+static void flep_rehash(struct FLEPEntry*** bucket, unsigned long* nbucket,
+  int by_ptr) {
+  unsigned long i, n = *nbucket * 2;
+  struct FLEPEntry **b = (struct FLEPEntry**)calloc(n, sizeof(*b)), *e, *x;
+  for (i = 0; i < *nbucket; i++) {
+    for (e = (*bucket)[i]; e; e = x) {
+      if (by_ptr) {
+	unsigned long h = flep_ptr_hash(e->f) & (n - 1);
+	x = e->pnext;
+	e->pnext = b[h];
+	b[h] = e;
+      } else {
+	x = e->next;
+	e->next = b[e->hash & (n - 1)];
+	b[e->hash & (n - 1)] = e;
+      }
+    }
+  }
+  free(*bucket);
+  *bucket = b;
+  *nbucket = n;
+}
+
+static void flep_ptr_insert(struct FLEPCache* c, struct FLEPEntry* e) {
+  unsigned long h = flep_ptr_hash(e->f);
+  struct FLEPPtrShard* p = c->ptr + FLEP_SHARD(h);
+  pthread_mutex_lock(&p->lock);
+  if (++p->n > p->nbucket) flep_rehash(&p->bucket, &p->nbucket, 1);
+  e->pnext = p->bucket[h & (p->nbucket - 1)];
+  p->bucket[h & (p->nbucket - 1)] = e;
+  pthread_mutex_unlock(&p->lock);
+}
+
+/* entry of "f", removing it from the pointer index if "remove" */
+static struct FLEPEntry* flep_ptr_find(struct FLEPCache* c,
+  const struct FLEP* f, int remove) {
+  unsigned long h = flep_ptr_hash(f);
+  struct FLEPPtrShard* p = c->ptr + FLEP_SHARD(h);
+  struct FLEPEntry **pe, *e;
+  pthread_mutex_lock(&p->lock);
+  pe = p->bucket + (h & (p->nbucket - 1));
+  while (*pe && (*pe)->f != f) pe = &(*pe)->pnext;
+  e = *pe;
+  if (e && remove) {
+    *pe = e->pnext;
+    p->n--;
+  }
+  pthread_mutex_unlock(&p->lock);
+  return e;
+}
+
+static void flep_entry_free(struct FLEPCache* c, struct FLEPEntry* e) {
+  flep_ptr_find(c, e->f, 1);
+  flep_free(e->f);
+  free(e->key);
+  free(e);
+}
+
+static struct FLEPEntry* flep_lookup(struct FLEPShard* sh, const char* key,
+  unsigned long h) {
+  struct FLEPEntry* e = sh->bucket[h & (sh->nbucket - 1)];
+  while (e && (e->hash != h || strcmp(e->key, key))) e = e->next;
+  return e;
+}
+
+static void flep_lru_unlink(struct FLEPShard* sh, struct FLEPEntry* e) {
+  if (e->older) e->older->newer = e->newer; else sh->oldest = e->newer;
+  if (e->newer) e->newer->older = e->older; else sh->newest = e->older;
+}
+
+static void flep_lru_push(struct FLEPShard* sh, struct FLEPEntry* e) {
+  e->older = sh->newest;
+  e->newer = 0;
+  if (sh->newest) sh->newest->newer = e; else sh->oldest = e;
+  sh->newest = e;
+}
+
+/* Drop least recently used entries until within budget, returning those
+ * no longer referenced (chained through "next") to be freed unlocked
+ */
+static struct FLEPEntry* flep_evict(struct FLEPCache* c,
+  struct FLEPShard* sh) {
+  struct FLEPEntry *dead = 0, *e, **pe;
+  while (sh->bytes > c->max_bytes && sh->oldest != sh->newest) {
+    e = sh->oldest;
+    flep_lru_unlink(sh, e);
+    pe = sh->bucket + (e->hash & (sh->nbucket - 1));
+    while (*pe != e) pe = &(*pe)->next;
+    *pe = e->next;
+    sh->n--;
+    sh->bytes -= e->bytes;
+    sh->evictions++;
+    e->cached = 0;
+    if (!e->refs) {
+      e->next = dead;
+      dead = e;
+    }
+  }
+  return dead;
+}
+
+struct FLEPCache* flep_cache_new(size_t max_bytes, int flags) {
+  struct FLEPCache* c = (struct FLEPCache*)calloc(1, sizeof(*c));
+  int i;
+  for (i = 0; i < FLEP_SHARDS; i++) {
+    pthread_mutex_init(&c->shard[i].lock, 0);
+    c->shard[i].nbucket = 16;
+    c->shard[i].bucket = (struct FLEPEntry**)calloc(16, sizeof(void*));
+    pthread_mutex_init(&c->ptr[i].lock, 0);
+    c->ptr[i].nbucket = 16;
+    c->ptr[i].bucket = (struct FLEPEntry**)calloc(16, sizeof(void*));
+  }
+  c->max_bytes = max_bytes / FLEP_SHARDS;
+  c->flags = flags;
+  return c;
+}
+
+const struct FLEP* flep_cache_get(struct FLEPCache* c, const char* s,
+  int* error, int* position) {
+  char* key = flep_normalize(s);
+  unsigned long h = flep_cache_hash(key);
+  struct FLEPShard* sh = c->shard + FLEP_SHARD(h);
+  struct FLEPEntry *e, *dead;
+  const struct FLEP* f;
+  pthread_mutex_lock(&sh->lock);
+  e = flep_lookup(sh, key, h);
+  if (e) {
+    e->refs++;
+    flep_lru_unlink(sh, e);
+    flep_lru_push(sh, e);
+    sh->hits++;
+    f = e->f;
+    pthread_mutex_unlock(&sh->lock);
+    free(key);
+    return f;
+  }
+  sh->misses++;
+  pthread_mutex_unlock(&sh->lock);
+  /* parse the string as given, so errors point into it */
+  f = flep_parse_flags(s, c->flags, error, position);
+  if (!f) {
+    free(key);
+    return 0;
+  }
+  e = (struct FLEPEntry*)malloc(sizeof(*e));
+  e->f = f;
+  e->key = key;
+  e->hash = h;
+  e->bytes = flep_memory(f) + strlen(key) + 1 + sizeof(*e);
+  e->refs = 1;
+  e->cached = 1;
+  /* indexed before others can find it in the table and release it */
+  flep_ptr_insert(c, e);
+  pthread_mutex_lock(&sh->lock);
+  dead = flep_lookup(sh, key, h);
+  if (dead) {
+    /* another thread parsed the same string meanwhile */
+    dead->refs++;
+    f = dead->f;
+    pthread_mutex_unlock(&sh->lock);
+    flep_entry_free(c, e);
+    return f;
+  }
+  if (++sh->n > sh->nbucket) flep_rehash(&sh->bucket, &sh->nbucket, 0);
+  e->next = sh->bucket[h & (sh->nbucket - 1)];
+  sh->bucket[h & (sh->nbucket - 1)] = e;
+  flep_lru_push(sh, e);
+  sh->bytes += e->bytes;
+  dead = flep_evict(c, sh);
+  pthread_mutex_unlock(&sh->lock);
+  while (dead) {
+    e = dead->next;
+    flep_entry_free(c, dead);
+    dead = e;
+  }
+  return f;
+}
+
+void flep_cache_release(struct FLEPCache* c, const struct FLEP* f) {
+  struct FLEPEntry* e = flep_ptr_find(c, f, 0);
+  struct FLEPShard* sh;
+  int unused;
+  if (!e) return;
+  sh = c->shard + FLEP_SHARD(e->hash);
+  pthread_mutex_lock(&sh->lock);
+  unused = (--e->refs == 0 && !e->cached);
+  pthread_mutex_unlock(&sh->lock);
+  if (unused) flep_entry_free(c, e);
+}
+
+void flep_cache_stats(struct FLEPCache* c, struct FLEPCacheStats* st) {
+  int i;
+  memset(st, 0, sizeof(*st));
+  for (i = 0; i < FLEP_SHARDS; i++) {
+    struct FLEPShard* sh = c->shard + i;
+    pthread_mutex_lock(&sh->lock);
+    st->hits += sh->hits;
+    st->misses += sh->misses;
+    st->evictions += sh->evictions;
+    st->entries += sh->n;
+    st->bytes += sh->bytes;
+    pthread_mutex_unlock(&sh->lock);
+  }
+}
+
+void flep_cache_free(struct FLEPCache* c) {
+  int i;
+  unsigned long j;
+  if (!c) return;
+  for (i = 0; i < FLEP_SHARDS; i++) {
+    /* every entry, cached or just referenced, is in the pointer index */
+    struct FLEPPtrShard* p = c->ptr + i;
+    for (j = 0; j < p->nbucket; j++) {
+      struct FLEPEntry *e, *x;
+      for (e = p->bucket[j]; e; e = x) {
+	x = e->pnext;
+	flep_free(e->f);
+	free(e->key);
+	free(e);
+      }
+    }
+    free(p->bucket);
+    pthread_mutex_destroy(&p->lock);
+    free(c->shard[i].bucket);
+    pthread_mutex_destroy(&c->shard[i].lock);
+  }
+  free(c);
+}
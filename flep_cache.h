@@ -0,0 +1,72 @@
+/*
+ * FLEP - Fast Lite Expression Parser
+ * Copyright (C) 2019 Gustavo Hime
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Cache of compiled expressions, shared by many threads: instead of calling
+ * "flep_parse" and "flep_free" for strings seen over and over, call
+ * "flep_cache_get" and "flep_cache_release". Strings differing only in
+ * whitespace which does not separate tokens (e.g. "a+b" and "a + b") share
+ * the same compiled expression.
+ * Requires POSIX threads (link with -lpthread).
+ */
+#ifndef FLEP_CACHE_H
+#define FLEP_CACHE_H
+#include "flep.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct FLEPCache; /* Opaque to user */
+
+struct FLEPCache* flep_cache_new(size_t max_bytes, int flags);
+/* Create a cache holding compiled expressions of up to about "max_bytes"
+ * (as counted by "flep_memory", plus the strings), compiled with
+ * "flep_parse_flags" and the given "flags". When full, the least recently
+ * used expressions are dropped.
+ */
+
+const struct FLEP* flep_cache_get(struct FLEPCache* c, const char* s,
+  int* error, int* position);
+/* As "flep_parse", but returns the expression compiled from an equivalent
+ * string if the cache holds one. The expression is valid until released
+ * with "flep_cache_release" (never call "flep_free" on it), even if it is
+ * meanwhile dropped from the cache. Errors are not cached.
+ */
+
+void flep_cache_release(struct FLEPCache* c, const struct FLEP* f);
+/* Release one reference to "f", returned by "flep_cache_get" */
+
+struct FLEPCacheStats {
+  unsigned long hits, misses, evictions;
+  unsigned long entries; /* expressions now in the cache */
+  size_t bytes; /* memory they use */
+};
+
+void flep_cache_stats(struct FLEPCache* c, struct FLEPCacheStats* st);
+/* Fill "st" with the counters of "c", summed over threads */
+
+void flep_cache_free(struct FLEPCache* c);
+/* Deallocate "c" and every expression in it. Expressions still referenced
+ * must not be used (nor released) afterwards.
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ * FLEP - Fast Lite Expression Parser
+ * Copyright (C) 2019 Gustavo Hime
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Work-stealing pool for "flep_eval_batch". Rows are cut into chunks small
+ * enough for their columns to stay in cache, and each thread of a call is
+ * handed an equal run of them, which it takes from the front. A thread
+ * whose run is done steals from the back of the others', so threads slowed
+ * down by the system (or by rows of costly values) are helped to finish.
+ * Every row is computed by the same code whatever thread takes it, so
+ * results do not depend on the number of threads.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flep_pool.h"
+
+#define FLEP_CHUNK_BYTES (1 << 18) /* of inputs and outputs per chunk */
+#define FLEP_CHUNK_ALIGN 64 /* rows, the block of "flep_eval_batch" */
+
+/* run of chunks left to a thread, [lo, hi) */
+struct FLEPDeque {
+  pthread_mutex_t lock;
+  size_t lo, hi;
+  char pad[64]; /* keep locks of different threads off the same line */
+};
+
+struct FLEPJob {
+  const struct FLEP* f;
+  const double* const* cols;
+  double* out;
+  size_t n, chunk, nchunk;
+  int nout, nwork; /* results per row, threads taking part */
+};
+
+struct FLEPWorker {
+  struct FLEPPool* p;
+  int id; /* 0 is the caller of "flep_pool_eval" */
+};
+
+struct FLEPPool {
+  pthread_mutex_t submit; /* held through each call */
+  pthread_mutex_t lock; /* guards the fields below up to "job" */
+  pthread_cond_t wake, done;
+  unsigned long round; /* number of calls so far */
+  int pending; /* started threads still working on this call */
+  int quit;
+  struct FLEPJob job;
+  struct FLEPDeque* dq;
+  struct FLEPWorker* worker;
+  pthread_t* thread;
+  int nthread; /* counting the caller */
+};
+
+/* next chunk for thread "id", or 0 if all are taken */
+static int flep_pool_next(struct FLEPPool* p, int id, size_t* c) {
+  int k, nwork = p->job.nwork;
+  for (k = 0; k < nwork; k++) {
+    struct FLEPDeque* d = p->dq + (id + k) % nwork;
+    int found;
+    pthread_mutex_lock(&d->lock);
+    found = d->lo < d->hi;
+    if (found) *c = k ? --d->hi : d->lo++;
+    pthread_mutex_unlock(&d->lock);
+    if (found) return 1;
+  }
+  return 0;
+}
+
+static void flep_pool_work(struct FLEPPool* p, int id) {
+  const struct FLEPJob* j = &p->job;
+  double* tmp = 0;
+  size_t c;
+  if (j->nout > 1) {
+    tmp = (double*)malloc(j->nout * j->chunk * sizeof(double));
+  }
+  while (flep_pool_next(p, id, &c)) {
+    size_t row = c * j->chunk, m = j->n - row;
+    const double* cols[7];
+    int k;
+    if (m > j->chunk) m = j->chunk;
+    for (k = 0; k < 7; k++) cols[k] = j->cols[k] ? j->cols[k] + row : 0;
+    if (!tmp) {
+      flep_eval_batch(j->f, cols, m, j->out + row);
+      continue;
+    }
+    /* chunk of each output column is "m" rows here, "n" in "out" */
+    flep_eval_batch(j->f, cols, m, tmp);
+    for (k = 0; k < j->nout; k++) {
+      memcpy(j->out + k * j->n + row, tmp + k * m, m * sizeof(double));
+    }
+  }
+  free(tmp);
+}
+
+static void* flep_pool_thread(void* arg) {
+  struct FLEPWorker* w = (struct FLEPWorker*)arg;
+  struct FLEPPool* p = w->p;
+  unsigned long seen = 0;
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (!p->quit && p->round == seen) {
+      pthread_cond_wait(&p->wake, &p->lock);
+    }
+    if (p->quit) break;
+    seen = p->round;
+    if (w->id >= p->job.nwork) continue;
+    pthread_mutex_unlock(&p->lock);
+    flep_pool_work(p, w->id);
+    pthread_mutex_lock(&p->lock);
+    if (--p->pending == 0) pthread_cond_signal(&p->done);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return 0;
+}
+
+struct FLEPPool* flep_pool_new(int threads) {
+  struct FLEPPool* p = (struct FLEPPool*)calloc(1, sizeof(*p));
+  int i;
+  if (threads < 1) threads = 1;
+  pthread_mutex_init(&p->submit, 0);
+  pthread_mutex_init(&p->lock, 0);
+  pthread_cond_init(&p->wake, 0);
+  pthread_cond_init(&p->done, 0);
+  p->dq = (struct FLEPDeque*)calloc(threads, sizeof(*p->dq));
+  p->worker = (struct FLEPWorker*)calloc(threads, sizeof(*p->worker));
+  p->thread = (pthread_t*)calloc(threads, sizeof(*p->thread));
+  for (i = 0; i < threads; i++) {
+    p->worker[i].p = p;
+    p->worker[i].id = i;
+  }
+  /* the caller is thread 0; make do with fewer if some fail to start */
+  for (p->nthread = 1; p->nthread < threads; p->nthread++) {
+    if (pthread_create(p->thread + p->nthread, 0, flep_pool_thread,
+	p->worker + p->nthread)) {
+      break;
+    }
+  }
+  for (i = 0; i < p->nthread; i++) pthread_mutex_init(&p->dq[i].lock, 0);
+  return p;
+}
+
+void flep_pool_eval(struct FLEPPool* p, const struct FLEP* f,
+  const double* const cols[7], size_t n, double* out, int threads) {
+  struct FLEPJob* j = &p->job;
+  int i, nout = flep_outputs(f);
+  size_t chunk = FLEP_CHUNK_BYTES / ((7 + nout) * sizeof(double));
+  chunk -= chunk % FLEP_CHUNK_ALIGN;
+  if (chunk < FLEP_CHUNK_ALIGN) chunk = FLEP_CHUNK_ALIGN;
+  if (flep_stride(f)) { /* records, not columns: only fills "out" */
+    flep_eval_batch(f, cols, n, out);
+    return;
+  }
+  if (threads <= 0 || threads > p->nthread) threads = p->nthread;
+  pthread_mutex_lock(&p->submit);
+  pthread_mutex_lock(&p->lock);
+  j->f = f;
+  j->cols = cols;
+  j->out = out;
+  j->n = n;
+  j->chunk = chunk;
+  j->nchunk = (n + chunk - 1) / chunk;
+  j->nout = nout;
+  j->nwork = (size_t)threads < j->nchunk ? threads : (int)j->nchunk;
+  if (j->nwork < 1) j->nwork = 1;
+  for (i = 0; i < j->nwork; i++) {
+    p->dq[i].lo = j->nchunk * i / j->nwork;
+    p->dq[i].hi = j->nchunk * (i + 1) / j->nwork;
+  }
+  p->pending = j->nwork - 1;
+  if (p->pending) {
+    p->round++;
+    pthread_cond_broadcast(&p->wake);
+  }
+  pthread_mutex_unlock(&p->lock);
+  flep_pool_work(p, 0);
+  pthread_mutex_lock(&p->lock);
+  while (p->pending) pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+  pthread_mutex_unlock(&p->submit);
+}
+
+void flep_pool_free(struct FLEPPool* p) {
+  int i;
+  if (!p) return;
+  pthread_mutex_lock(&p->lock);
+  p->quit = 1;
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+  for (i = 1; i < p->nthread; i++) pthread_join(p->thread[i], 0);
+  for (i = 0; i < p->nthread; i++) pthread_mutex_destroy(&p->dq[i].lock);
+  pthread_mutex_destroy(&p->submit);
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->wake);
+  pthread_cond_destroy(&p->done);
+  free(p->dq);
+  free(p->worker);
+  free(p->thread);
+  free(p);
+}
@@ -0,0 +1,56 @@
+/*
+ * FLEP - Fast Lite Expression Parser
+ * Copyright (C) 2019 Gustavo Hime
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Pool of threads evaluating an expression over many rows: the same as
+ * "flep_eval_batch", with the rows spread over cores. The threads are
+ * started once, with the pool, and wait for work between calls.
+ * Requires POSIX threads (link with -lpthread).
+ */
+#ifndef FLEP_POOL_H
+#define FLEP_POOL_H
+#include "flep.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct FLEPPool; /* Opaque to user */
+
+struct FLEPPool* flep_pool_new(int threads);
+/* Create a pool for up to "threads" threads, counting the caller of
+ * "flep_pool_eval" (so "threads" - 1 are started, or fewer if the system
+ * refuses more).
+ */
+
+void flep_pool_eval(struct FLEPPool* p, const struct FLEP* f,
+  const double* const cols[7], size_t n, double* out, int threads);
+/* As "flep_eval_batch" (so "f" must not be bound by "flep_bind", or
+ * "out" is filled with NaN), using at most "threads" threads of "p" (or
+ * all of them if 0). Results are identical to "flep_eval_batch" whatever
+ * the number of threads. Calls on the same pool from several threads are
+ * run one after the other.
+ */
+
+void flep_pool_free(struct FLEPPool* p);
+/* Stop the threads of "p" and deallocate it */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,374 @@
+/*
+ * FLEP - Fast Lite Expression Parser
+ * Copyright (C) 2019 Gustavo Hime
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Streaming evaluator: one or more expressions over all rows of column
+ * files, each the raw doubles (in the machine's byte order) of a variable,
+ * e.g. "-a a.bin" for "a". Files are mapped to memory and read in chunks
+ * of rows, each chunk being evaluated by "flep_eval_batch" while another
+ * thread writes the results of the previous one, and pages already read
+ * are dropped from the process, so that it holds a few chunks of each
+ * file however large the inputs. Results go to standard output, or the
+ * file given with "-o", as raw doubles, one per expression for each row
+ * in turn, or as text with "-t" (one line per row). "-r" sets the rows
+ * per chunk, "-j" the threads evaluating chunks (1 by default, more for
+ * expressions too costly to keep up with the disk), "-fast" and "-approx"
+ * parse with FLEP_FASTMATH and FLEP_APPROX, and "-v" reports the
+ * throughput to standard error.
+ * Expressions starting with "-" follow "--".
+ *
+ *   flep_stream [-a file] ... [-w file] [-o file] [-t] [-r rows]
+ *     [-j threads] [-fast] [-approx] [-v] [--] expression ...
+ */
+#define _POSIX_C_SOURCE 200112L /* posix_madvise, clock_gettime */
+#define _DEFAULT_SOURCE /* madvise, MADV_DONTNEED */
+#define _FILE_OFFSET_BITS 64 /* files over 2 GB where "long" is 32 bits */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flep.h"
+
+#define CHUNK 65536 /* default rows per chunk, 512 kB per column */
+#define AHEAD 8 /* chunks read ahead of the one evaluated */
+#define TEXTLEN 26 /* characters per value as text, at most */
+
+double now(void) {
+  struct timespec t;
+  if (clock_gettime(CLOCK_MONOTONIC, &t)) return 0;
+  return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+}
+
+/* Map "name" to memory, to be read from start to end, in "*col" (NULL if
+ * empty) with its number of rows in "*rows"; 0 on failure
+ */
+int map_column(const char* name, const double** col, size_t* rows) {
+  struct stat st;
+  void* p;
+  int fd = open(name, O_RDONLY);
+  *col = 0;
+  *rows = 0;
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open column file \"%s\"\n", name);
+    return 0;
+  }
+  if (fstat(fd, &st) || st.st_size % sizeof(double) ||
+    (off_t)(size_t)st.st_size != st.st_size) {
+    fprintf(stderr, "Column file \"%s\" is not a whole number of doubles "
+      "that can be mapped\n", name);
+    close(fd);
+    return 0;
+  }
+  if (!st.st_size) {
+    close(fd);
+    return 1;
+  }
+  p = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); /* the mapping remains */
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "Failed to map column file \"%s\"\n", name);
+    return 0;
+  }
+  posix_madvise(p, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+  *col = (const double*)p;
+  *rows = (size_t)st.st_size / sizeof(double);
+  return 1;
+}
+
+/* Hint that rows "from" to "to" of the mapped columns are to be read next,
+ * or with "advice" POSIX_MADV_DONTNEED, drop them from the process: glibc
+ * ignores that advice to "posix_madvise", hence "madvise", which only
+ * discards the pages of these read-only shared mappings (the file keeps
+ * them, and they are read again if touched)
+ */
+void advise(const double* const base[7], size_t from, size_t to,
+  int advice) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t start = from * sizeof(double), end = to * sizeof(double);
+  int k;
+  if (from >= to) return;
+  start -= start % page; /* mappings start on a page */
+  if (advice == POSIX_MADV_DONTNEED) end -= end % page; /* whole pages */
+  if (start >= end) return;
+  for (k = 0; k < 7; k++) {
+    void* p;
+    if (!base[k]) continue;
+    p = (void*)((const char*)base[k] + start);
+    if (advice == POSIX_MADV_DONTNEED) madvise(p, end - start, MADV_DONTNEED);
+    else posix_madvise(p, end - start, advice);
+  }
+}
+
+/* Shared by the threads: evaluating threads take chunks of rows in turn,
+ * chunk "c" going to buffer c % nbuf, and the writing thread writes the
+ * buffers in the order of the chunks. With one evaluating thread and two
+ * buffers, this is double buffering.
+ */
+struct Stream {
+  pthread_mutex_t lock;
+  pthread_cond_t cond; /* signalled when a buffer is filled or written */
+  const struct FLEP* f;
+  const double* base[7]; /* mapped columns, NULL if none */
+  size_t rows, chunk, nchunk; /* rows, per chunk, chunks */
+  size_t next; /* chunk for the next evaluating thread to take */
+  int nout, text, nbuf;
+  FILE* file;
+  char** buf;
+  size_t* len; /* bytes to write from each buffer */
+  size_t* turn; /* chunk each buffer is to hold next */
+  int* full; /* set once filled, cleared once written */
+  int error; /* a write failed, the threads stop */
+};
+
+/* An evaluating thread, with room for the results of a chunk */
+struct Worker {
+  struct Stream* s;
+  double* out;
+  pthread_t thread;
+};
+
+void* evaluate_chunks(void* arg) {
+  struct Stream* s = ((struct Worker*)arg)->s;
+  double* out = ((struct Worker*)arg)->out;
+  for (;;) {
+    const double* cols[7];
+    size_t c, row, n, len, i;
+    int b, k;
+    char* buf;
+    pthread_mutex_lock(&s->lock);
+    c = s->next++;
+    b = (int)(c % s->nbuf);
+    while (!s->error && c < s->nchunk && s->turn[b] != c) {
+      pthread_cond_wait(&s->cond, &s->lock);
+    }
+    if (s->error || c >= s->nchunk) {
+      pthread_mutex_unlock(&s->lock);
+      break;
+    }
+    pthread_mutex_unlock(&s->lock);
+    buf = s->buf[b];
+    row = c * s->chunk;
+    n = s->rows - row < s->chunk ? s->rows - row : s->chunk;
+    i = row + AHEAD * s->chunk; /* the chunk AHEAD after this one */
+    if (i < s->rows) {
+      advise(s->base, i, s->rows - i < n ? s->rows : i + n,
+	POSIX_MADV_WILLNEED);
+    }
+    for (k = 0; k < 7; k++) cols[k] = s->base[k] ? s->base[k] + row : 0;
+    if (s->text) {
+      flep_eval_batch(s->f, cols, n, out);
+      for (len = 0, i = 0; i < n; i++) {
+	for (k = 0; k < s->nout; k++) {
+	  len += sprintf(buf + len, "%.17g%c", out[k * n + i],
+	    k + 1 < s->nout ? '\t' : '\n');
+	}
+      }
+    } else if (s->nout == 1) {
+      flep_eval_batch(s->f, cols, n, (double*)buf);
+      len = n * sizeof(double);
+    } else { /* rows in turn rather than expressions */
+      double* o = (double*)buf;
+      flep_eval_batch(s->f, cols, n, out);
+      for (i = 0; i < n; i++) {
+	for (k = 0; k < s->nout; k++) o[i * s->nout + k] = out[k * n + i];
+      }
+      len = n * s->nout * sizeof(double);
+    }
+    advise(s->base, row, row + n, POSIX_MADV_DONTNEED);
+    pthread_mutex_lock(&s->lock);
+    s->len[b] = len;
+    s->full[b] = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+  }
+  return 0;
+}
+
+void* write_chunks(void* arg) {
+  struct Stream* s = (struct Stream*)arg;
+  size_t c;
+  for (c = 0; c < s->nchunk; c++) {
+    int b = (int)(c % s->nbuf), error;
+    pthread_mutex_lock(&s->lock);
+    while (!s->full[b]) pthread_cond_wait(&s->cond, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    error = fwrite(s->buf[b], 1, s->len[b], s->file) != s->len[b];
+    pthread_mutex_lock(&s->lock);
+    s->full[b] = 0;
+    s->turn[b] += s->nbuf;
+    s->error = error;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    if (error) break;
+  }
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  static const char* vars = "abcxyzw";
+  const char** exprs = (const char**)malloc(argc * sizeof(char*));
+  const char *name[7] = {0, 0, 0, 0, 0, 0, 0}, *outname = 0;
+  struct Stream s;
+  struct Worker* w;
+  pthread_t writer;
+  size_t size[7], bytes;
+  double t0 = now();
+  int text = 0, flags = 0, verbose = 0, nexpr = 0, ncol = 0, jobs = 1;
+  int used, status = 0, error, position, which, i, k, options = 1;
+  s.chunk = CHUNK;
+  for (i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    if (options && a[0] == '-' && a[1] && strchr(vars, a[1]) && !a[2] &&
+      i + 1 < argc) {
+      name[strchr(vars, a[1]) - vars] = argv[++i];
+    } else if (options && !strcmp(a, "-o") && i + 1 < argc) {
+      outname = argv[++i];
+    } else if (options && !strcmp(a, "-r") && i + 1 < argc) {
+      long r = atol(argv[++i]);
+      s.chunk = r > 0 ? (size_t)r : CHUNK;
+    } else if (options && !strcmp(a, "-j") && i + 1 < argc) {
+      jobs = atoi(argv[++i]);
+      if (jobs < 1) jobs = 1;
+    } else if (options && !strcmp(a, "-t")) text = 1;
+    else if (options && !strcmp(a, "-fast")) flags |= FLEP_FASTMATH;
+    else if (options && !strcmp(a, "-approx")) flags |= FLEP_APPROX;
+    else if (options && !strcmp(a, "-v")) verbose = 1;
+    else if (options && !strcmp(a, "--")) options = 0;
+    else if (options && a[0] == '-' && a[1]) {
+      fprintf(stderr, "Unknown option \"%s\"\n", a);
+      return 1;
+    } else exprs[nexpr++] = a;
+  }
+  if (!nexpr) {
+    fprintf(stderr, "usage: flep_stream [-a file] ... [-w file] [-o file] "
+      "[-t] [-r rows] [-j threads]\n  [-fast] [-approx] [-v] [--] "
+      "expression ...\n");
+    return 1;
+  }
+  s.f = flep_parse_many(exprs, nexpr, flags, &error, &position, &which);
+  if (!s.f) {
+    fprintf(stderr, "FLEP failed to parse (%s)\n%s\n%*s\n",
+      flep_translate(error), exprs[which], position, "^");
+    return 1;
+  }
+  s.nout = flep_outputs(s.f);
+  used = flep_variables(s.f);
+  s.rows = 0;
+  for (k = 0; k < 7; k++) {
+    s.base[k] = 0;
+    size[k] = 0;
+    if (used >> k & 1 && !name[k]) {
+      fprintf(stderr, "Variable \"%c\" has no column file (-%c)\n",
+	vars[k], vars[k]);
+      return 1;
+    }
+    if (!name[k]) continue;
+    if (!map_column(name[k], &s.base[k], &size[k])) return 1;
+    if (ncol++ && size[k] != s.rows) {
+      fprintf(stderr, "Column file \"%s\" has %lu rows, others %lu\n",
+	name[k], (unsigned long)size[k], (unsigned long)s.rows);
+      return 1;
+    }
+    s.rows = size[k];
+  }
+  if (!ncol) {
+    fprintf(stderr, "No column file, hence no rows\n");
+    return 1;
+  }
+  s.file = stdout;
+  if (outname && !(s.file = fopen(outname, "wb"))) {
+    fprintf(stderr, "Failed to open output file \"%s\"\n", outname);
+    return 1;
+  }
+  s.nchunk = (s.rows + s.chunk - 1) / s.chunk;
+  s.next = 0;
+  s.text = text;
+  s.nbuf = 2 * jobs;
+  s.error = 0;
+  s.buf = (char**)calloc(s.nbuf, sizeof(char*));
+  s.len = (size_t*)calloc(s.nbuf, sizeof(size_t));
+  s.turn = (size_t*)calloc(s.nbuf, sizeof(size_t));
+  s.full = (int*)calloc(s.nbuf, sizeof(int));
+  w = (struct Worker*)calloc(jobs, sizeof(struct Worker));
+  bytes = s.chunk * s.nout * (text ? TEXTLEN : sizeof(double));
+  if (!s.buf || !s.len || !s.turn || !s.full || !w) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  for (i = 0; i < s.nbuf; i++) {
+    s.turn[i] = i;
+    if (!(s.buf[i] = (char*)malloc(bytes))) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+  }
+  for (i = 0; i < jobs; i++) {
+    w[i].s = &s;
+    if (!(w[i].out = (double*)malloc(s.chunk * s.nout * sizeof(double)))) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+  }
+  pthread_mutex_init(&s.lock, 0);
+  pthread_cond_init(&s.cond, 0);
+  advise(s.base, 0, AHEAD * s.chunk < s.rows ? AHEAD * s.chunk : s.rows,
+    POSIX_MADV_WILLNEED);
+  if (pthread_create(&writer, 0, write_chunks, &s)) {
+    fprintf(stderr, "Failed to create threads\n");
+    return 1;
+  }
+  for (i = 0; i < jobs; i++) {
+    if (pthread_create(&w[i].thread, 0, evaluate_chunks, &w[i])) {
+      fprintf(stderr, "Failed to create threads\n");
+      return 1;
+    }
+  }
+  for (i = 0; i < jobs; i++) pthread_join(w[i].thread, 0);
+  pthread_join(writer, 0);
+  if (s.error || fflush(s.file) || ferror(s.file)) {
+    fprintf(stderr, "Failed to write results\n");
+    status = 1;
+  }
+  if (outname && fclose(s.file)) status = 1;
+  if (verbose) {
+    double t = now() - t0;
+    fprintf(stderr, "%lu rows of %d columns, %d expressions: %.3f s, "
+      "%.1f MB/s read\n", (unsigned long)s.rows, ncol, s.nout, t,
+      t > 0 ? 1e-6 * s.rows * ncol * sizeof(double) / t : 0);
+  }
+  for (k = 0; k < 7; k++) {
+    if (s.base[k]) munmap((void*)s.base[k], size[k] * sizeof(double));
+  }
+  pthread_mutex_destroy(&s.lock);
+  pthread_cond_destroy(&s.cond);
+  for (i = 0; i < s.nbuf; i++) free(s.buf[i]);
+  for (i = 0; i < jobs; i++) free(w[i].out);
+  free(s.buf);
+  free(s.len);
+  free(s.turn);
+  free(s.full);
+  free(w);
+  free(exprs);
+  flep_free(s.f);
+  return status;
+}